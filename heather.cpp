@@ -407,6 +407,26 @@
 //   connection by using a ';' before the port number.
 //
 //
+//   On Linux and macOS Heather can serve its live state (PPS/OSC offsets,
+//   DAC,  temperature,  sat count,  holdover state,  alarm bits,  xDEV bins,
+//   and com error counters) to Prometheus or any other program that can
+//   read its text format:
+//      /ws             - serve http://127.0.0.1:9110/metrics
+//      /ws=port        - serve on localhost port #
+//      /ws=addr:port   - serve on the given address (use 0.0.0.0 to allow
+//                        other machines to connect)
+//   The values are updated once per second.  Values the receiver does not
+//   report are not shown.
+//
+//   Local programs that want the receiver state more often can read it 
+//   from a shared memory segment that is updated on every timing message:
+//      /wm             - publish the state in shared memory segment /heather
+//      /wm=name        - use shared memory segment "name"
+//   The layout of the data (struct SHM_STATE) and how to read it safely
+//   are described in heather.ch and in the "Shared memory live state" 
+//   section of heather.cpp.
+//
+//
 //   For hardware serial port and USB serial connections you can specify the
 //   serial port baud rate and data format with the "/br=" command line option:
 //      /br=9600:8:N:1   (9600 baud, 8 data bits, no parity, 1 stop bit)
@@ -614,6 +634,14 @@
 //     simulation file before reading.  This lets you skip over data you are
 //     not interested in.
 //
+//   Indexed .hrc capture files (see /dr) are normally read as fast as
+//   possible like .raw files.  The /rp command line option replays them with
+//   the timing that the data originally arrived with:
+//     /rp       - replay in real time
+//     /rp=10    - replay 10 times faster than real time
+//   For .hrc files the ",seek" value is the number of seconds into the
+//   capture to start at.
+//
 //   You should also specify "/0" on the command line to disable the com 
 //   port, but this is not usually necessary.
 //
@@ -1947,6 +1975,23 @@
 //   provides some protection from data loss if your system crashes or loses
 //   power.
 //
+//   On Linux, macOS, and FreeBSD the log, PRN, RINEX, and TICC capture files are
+//   written by a background writer thread.  The program formats the data 
+//   into a memory buffer and the writer thread copies it to disk, so a slow
+//   SD card or network drive does not hold up receiver message processing.
+//   The /la command line option turns the writer thread off.  The /ly=#
+//   option sets when the writer forces data to the disk (fsync):
+//      /ly=-1  - never,  let the operating system decide
+//      /ly=0   - when the log is synced once per hour (default)
+//      /ly=#   - every # seconds
+//
+//   If a log, raw receiver data, PRN, or TICC file name ends in .gz the file
+//   is written gzip compressed (if Heather was built with zlib).  A flush
+//   point is written every 64 KB of data and on each fsync, so a crash
+//   only loses the data since the last flush point.  Compressed log,
+//   simulation (/rs, /ri), and .tie files are decompressed automatically
+//   when they are read.
+//
 //   The contents of the log files depends upon the receiver type.
 //
 //   Lady Heather supports several different log file formats.  The file format
@@ -1962,6 +2007,20 @@
 //              doppler, signal level) output of receivers that can supply this
 //              data.  RINEX data can be post-proceesed to provide precise
 //              locations.  See the section below on RINEX files.
+//      .hbl  - a columnar binary log of the plot queue.  These can only be
+//              written from the plot queue (WA / WP commands) and reload
+//              much faster than the text formats.  The queue data values
+//              are stored exactly so a reload gives back the same queue
+//              and adev values.  The command line option /lb converts
+//              the log file given with /r to a .hbl file and exits:
+//                 heather /r=old.log /lb=new.hbl
+//              (if no /lb file name is given the /r name is used with a
+//              .hbl extension).  The entries are written to the .hbl file
+//              as the log is read so logs that are longer than the plot
+//              queue are converted completely.  When a TICC .hbl file is
+//              read all four channels are replayed into the adev queues.
+//      .rra  - a round robin trend archive (see below).  Reading a .rra
+//              file loads one of its tiers into the plot queue.
 //
 //   Note that .gpx / .xml / .kml / .obsfiles are larger than the .log ASCII
 //   files.  The .xml (GPX 1.1) log format contains the most comprehensive 
@@ -2022,6 +2081,29 @@
 //
 //            You cannot write a RINEX file from plot queue data.
 //
+//            .log files are written from the plot queue in the background.
+//            The screen and the receiver keep updating while the file is
+//            written.  The "tblock" lock file is removed when the dump
+//            is finished.
+//
+//
+//   Lady Heather can keep a long term trend archive of the plot queue data 
+//   in a fixed size file.  The archive holds three tiers of data:
+//      1 second values for 3 days
+//      1 minute average / minimum / maximum values for 90 days
+//      1 hour average / minimum / maximum values for 10 years
+//   Every plot queue entry is added to all of the tiers.  The file is
+//   created at its full size (about 80 MB) so it never grows.  To keep an
+//   archive:
+//      /ra[=file] - (default file name is heather.rra)
+//
+//   Reading a .rra file (R command or /r) loads the finest tier that covers
+//   the time window (see /rw or file@start,end) and fits in the plot queue
+//   into the plot queue.  The normal view and review commands then work on
+//   the archive data.  The queue interval is set to the tier's step time
+//   unless you have set it with /i.  /rv=min or /rv=max reads the tier's
+//   minimum or maximum values instead of the averages.
+//
 //
 //   You can delete files:
 //      WD  - deletes a file
@@ -2078,6 +2160,14 @@
 //      every byte is OS resource intensive but helps make sure all data
 //      has been written to disk if an unexpected program crash occurs.
 //      In raw flush mode the "Cap:" log file name is shown as "CAP:".
+//
+//      If the capture file name ends in .hrc an indexed capture file is
+//      written.  The receiver data is stored in chunks tagged with the time
+//      that the bytes arrived and a seek index is written at the end of the
+//      file when it is closed.  Appending (F2 in the terminal) adds a new
+//      session to the file.  If Heather crashes the index is rebuilt from
+//      the chunks the next time the file is appended to.  In flush mode
+//      .hrc files are flushed a chunk at a time.
 //     
 //
 //
@@ -2134,6 +2224,18 @@
 //                command line option.  You cannot use multiple /r= options
 //                to read and append multiple log files.
 //
+//   You can read just part of a long .log file by giving a time window
+//   after the file name:
+//      R  file.log@2024-05-01           - reads the day starting at 00:00:00
+//      R  file.log@2024-05-01T12:00,2024-05-03
+//      /r=file.log /rw=2024-05-01,2024-05-03T06:00:00
+//
+//   While a .log file is read, Heather saves a sparse index of time stamps
+//   and file positions next to it (file.log.idx).  Later windowed reads use
+//   the index to seek straight to the requested time instead of parsing the
+//   whole file.  The index is rebuilt if the log file is changed other than
+//   by appending data to it.
+//
 //
 //
 //   Log files can be automatically written on a scheduled basis.  See the
@@ -2278,6 +2380,20 @@
 //                   the file starts writing)
 //      MW         - from the keyboard - opens/closes the RINEX file to write.
 //
+//      /mc=name[,N] - convert the raw receiver data capture file given with
+//                   /rs to the RINEX file "name" and exit.  The capture is
+//                   processed as fast as possible.  On Linux/macOS/FreeBSD
+//                   an indexed .hrc capture file (see /dr) is split into N
+//                   time segments that are converted in parallel by N
+//                   copies of Heather.  The extra copies run headless (no
+//                   window or receiver port) and only write their part of
+//                   the RINEX file,  the log,  debug,  raw data,  trend
+//                   archive,  /ws,  /wm and sky prediction outputs are left
+//                   to the main copy.  If N is not given one copy per
+//                   processor is used.  Each copy starts decoding up to a
+//                   minute before its segment so that the receiver state is
+//                   known at the segment start.  /mc replaces any /mw file.
+//
 //
 //      MX         - from the keyboard - sets the receiver baud rate.
 //                 See the warning above about the implications of setting
@@ -3924,6 +4040,17 @@
 //      /sd  - from the command line - toggle display of time markers on the
 //             satellite trails
 //
+//   Lady Heather can also predict where the satellites will be over the next
+//   24 hours from the ephemeris and almanac data the receiver has sent.  The
+//   prediction runs in the background and is updated whenever new orbit
+//   data arrives.  The predicted positions are shown as GREY dots on the
+//   satellite map.  Only receivers that send raw orbit data (currently
+//   Trimble TSIP receivers) can do this.
+//      /sk  - toggle display of the predicted satellite positions
+//      /sk=file - write the predicted number of satellites above the
+//             elevation mask (and their PRNs) for each 10 minutes of the
+//             next 24 hours to a file (default extension .sky)
+//
 //
 //   The satellite position map includes a representation of the sun at its 
 //   current location in the sky.  The sun is shown in solid YELLOW if it is 
@@ -4679,6 +4806,12 @@
 //           Gp/N   - minimum value
 //           Gp/X   - maximum value
 //           Gp/P   - span - difference between maximum and minimum values
+//           Gp/M   - median (50th percentile) of all the plot queue data
+//           Gp/9   - 99th percentile of all the plot queue data
+//           Gp/3   - 99.9th percentile of all the plot queue data
+//                    (the percentiles come from streaming histograms that
+//                    are kept current as points enter and leave the plot
+//                    queue,  so they are accurate to about 0.4 percent)
 //           Gp<cr> - turns off the plots' statistic display
 //           Gp/?   - toggles showing all 7 statistics for a selected plot.
 //                    The values are shown as "debug" info in the plot area.
@@ -4750,10 +4883,11 @@
 //                 various FFT bin values.
 //
 //                 The max FFT size is set by the /qf[=#] command line option.
-//                 (1024 points... if not given then /qf is 4096 points,
-//                 otherwise it is whatever is set (must be a power of 2). If
-//                 the number of data points in the plot queue to less than
-//                 the FFT size, the FFT size is reduced accordingly.
+//                 (262144 points... if not given then /qf is 4096 points,
+//                 otherwise it is whatever is set).  The FFT size does not
+//                 need to be a power of 2.  If the number of data points in
+//                 the plot queue to less than the FFT size, the FFT uses all 
+//                 of the available points.
 //
 //                 Note that a FFT requires the input data to be bandwidth
 //                 limited to below the sample frequency or else you will.  
@@ -4764,9 +4898,19 @@
 //                 The FFT plot option defaults to doing a single
 //                 FFT of the selected plots' data when the FFT command was
 //                 given.  The O L keyboard command can be used
-//                 to enable a "live" FFT that gets recalculated
+//                 to enable a "live" FFT that gets updated
 //                 every time a new point is added to the plot.
 //
+//                 The live FFT is a sliding DFT over the most recent
+//                 plot queue entries (the unfiltered data, one sample per
+//                 queue entry).  Each new point updates the spectrum
+//                 without redoing the FFT, so it is cheap enough to leave
+//                 on.  The /ql[=#] command line option sets the live FFT
+//                 size (default 4096 points, limited to the /qf size).
+//                 The ZF keyboard command shows a full screen waterfall
+//                 of the live FFT that adds a row as each new point
+//                 arrives.
+//
 //                 The O D keyboard option toggles the FFT display value
 //                 format between raw values (default) and dB's.
 //
@@ -4775,10 +4919,45 @@
 //                 the last point is marked with MARKER 2.
 //
 //
-//        GpH  - calculates a histogram of the currently displayed plot
-//               queue data.  The histogram and FFT options share the
-//               the plot same display code and cannot be used at the same
-//               time.
+//        GpH  - calculates a histogram of the plot queue data.  The
+//               histogram and FFT options share the the plot same display
+//               code and cannot be used at the same time.
+//
+//               The histogram is drawn from a streaming log-linear
+//               histogram of all of the queued data that is updated as
+//               points are added and dropped,  so it does not rescan the
+//               queue and its range follows the data.  The plot title
+//               shows the 50th, 99th, and 99.9th percentiles.  For time
+//               interval plots shown as frequency (Gp#) the histogram of
+//               the displayed data is calculated instead.
+//
+//        GpK  - cross-correlates the selected plot with another plot.
+//               You are prompted for the other plot's name (as shown in
+//               the plot headers,  e.g. DAC or TEMP).  The whole plot
+//               queue of both plots is correlated in the background
+//               (the program keeps running while it works).  The plot
+//               title then shows which plot lags the other and by how
+//               many seconds,  the correlation coefficient at that lag,
+//               and at zero lag.  The FFT plot shows the coherence
+//               spectrum (0 to 1) of the two plots,  calculated from
+//               Hann windowed segments of the /af segment length.  If
+//               the debug log is open,  the results and coherence values
+//               are written to it.
+//
+//        GpW  - shows a Welch power spectral density of the selected
+//               plot in the FFT plot.  The data is split into Hann
+//               windowed, linear detrended segments that overlap by 50%
+//               and the segment spectra are averaged.  The average is
+//               seeded from the plot queue and then updated as each new
+//               segment fills, so it stays current without redoing the
+//               whole analysis.  For PPS and time interval counter phase
+//               plots (in ns) the PSD is shown in dB as S_y(f) fractional
+//               frequency noise.  The /af command line option sets the
+//               segment length (default 1024 points) and whether S_x(f)
+//               time error (/af=,x), S_y(f) (/af=,y) or S_phi(f) phase
+//               noise at the channel's nominal frequency (/af=,p) is shown.
+//               More points give finer frequency resolution but fewer
+//               segments to average.
 //
 //
 //        GF   - toggle the FFT or histogram plot display on and off.
@@ -5653,12 +5832,46 @@
 //   another xDEV type,  but xDEVs and MTIE cannot be shown on the screen
 //   at the same time.
 //
-//   The AI command enables the MTIE display.  Heather uses Bregni's algorithm
-//   to calculate MTIE.  Bregni's algorithm is very fast but limits the
-//   intervals to powers of 2.  The maximum time interval used is the largest
-//   power of 2 <= the adev queue size value.  MTIE CALCULATION STOPS
-//   WHENEVER THE MAXIMUM TIME INTERVAL IS REACHED.  The CI command will 
-//   clear the MTIE data and start over.
+//   The AI command enables the MTIE display.  Heather calculates MTIE
+//   as a stream using sliding window min/max tracking, so MTIE keeps
+//   updating for as long as data arrives.  The most recent TIE values are
+//   kept in a buffer the size of the largest power of 2 >= the adev queue
+//   size.  The maximum time interval used is limited by that buffer size.
+//   The CI command will clear the MTIE data and start over.
+//
+//   MTIE is shown at the same taus as the ADEV bins (see the /as bin
+//   spacing command).  The /am command line option toggles the MTIE 
+//   display to use power of 2 taus instead.
+//
+//   The /ag command line option checks the MTIE and TDEV values against 
+//   an ITU wander mask as each sample arrives.  If any tau goes from
+//   passing to failing the mask the alarm is sounded (press any key
+//   to silence it).  The pass/fail margins are written along with the 
+//   MTIE data by the dump_mtie output and the adev log.
+//      /ag=811    - G.811 PRC mask
+//      /ag=812    - G.812 type I SSU mask
+//      /ag=8272a  - G.8272 PRTC-A mask (also the default for /ag)
+//      /ag=8272b  - G.8272 PRTC-B mask
+//      /ag=none   - turn off mask checking
+//
+//
+//   BATCH ANALYSIS
+//
+//   Heather can calculate the xDEV and MTIE tables for a set of log or
+//   .tie files without opening a window or connecting to a receiver:
+//      /ba=file   - add a log or .tie file to analyze.  The option can be
+//                   given several times and the name can include the
+//                   * and ? wildcards (Linux/macOS/FreeBSD).  Each file's
+//                   tables are written to "file.csv" (or "file.json")
+//                   and Heather exits when all the files are done.
+//      /bf=csv    - write the batch results as CSV (the default)
+//      /bf=json   - write the batch results as JSON
+//      /bj=#      - analyze up to # files at a time.  The default is one
+//                   per processor.  On Windows files are analyzed one
+//                   at a time.
+//
+//   The CSV files have one line per tau:  file,channel,type,tau,value,n
+//   Errors are shown on the console and do not stop the batch.
 //
 //
 //   --------------------------  WARNING --------------------------
@@ -5945,6 +6158,25 @@
 //      keyboard will not respond.
 //
 //
+//      The /ad command line option enables the N-cornered hat.  With a
+//      time interval counter each channel measures an oscillator against 
+//      the counter's reference clock.  The N-cornered hat uses the ADEVs
+//      of each pair of oscillators to estimate the ADEV of each individual
+//      oscillator.  The counter reference is always one of the corners
+//      so two active channels give a three-cornered hat.  The results are
+//      written to the log file along with the other adev tables.  Taus
+//      where an oscillator is too quiet to separate from the others are
+//      shown as "unresolved".
+//
+//      The channel readings are paired by their time stamps so a reading
+//      that is missing from one channel does not shift the pairing of the
+//      later readings.  The channel difference data is collected from the
+//      time the hat is enabled (it is not checkpointed by /ac) and the hat
+//      is recalculated in the background.
+//         /ad        - use all TICC channels that have data
+//         /ad=abc    - use the specified channels
+//
+//
 //      The AE keyboard command or /ae= command line option toggles the 
 //      display of ADEV error bars in the plots.  Error bars that are shown
 //      with arrow points on the ends indicate an adev bin with not enough
@@ -5952,6 +6184,24 @@
 //      one minor plot division are not shown.
 //
 //
+//      Recalculating the adevs after a restart can take a long time with
+//      large adev queues.  The /ac command line option saves the adev
+//      queues, the incremental adev bin values, and the MTIE data to a
+//      binary checkpoint file when Heather exits (and periodically while
+//      it runs).  On the next startup the checkpoint is reloaded and the
+//      adevs continue updating from where they left off.
+//         /ac            - use checkpoint file "heather.adv"
+//         /ac=file       - use the specified checkpoint file
+//         /ac=file,secs  - also set how often the file is written (default
+//                          is every 600 seconds)
+//      The checkpoint is ignored if it was written with a different adev
+//      period, bin spacing sequence, or larger adev queue size than the
+//      ones currently in effect.  It is also not loaded if a log file is
+//      read in with the /r= command line option.  However old the checkpoint
+//      is,  the new data is spliced onto it and the gap is flagged like a
+//      skipped time stamp (in the plot and with a log file comment).
+//
+//
 //
 //
 //-USING HEATHER WITH FREQUENCY AND TIME INTERVAL COUNTERS
@@ -8591,83 +8841,1773 @@ char *star;
       *star = 0;
       rinex_flush_mode = 1;
    }
-   else rinex_flush_mode = 0;
+   else rinex_flush_mode = 0;
+
+   rinex_file = async_topen(s, "w");
+   if(rinex_file) {
+      if(debug_file) fprintf(debug_file, "! RINEX file %s opened\n", s);
+   }
+   strcpy(rinex_name, s);
+   rinex_header_written = 0;
+   first_obs = 1;
+   return rinex_file;
+}
+
+//
+//   Indexed raw receiver capture files (.hrc)
+//
+//   Bytes from the receiver are grouped into chunks that carry the time
+//   that they arrived,  so a capture can be replayed with its original
+//   timing.  A seek index of chunk offsets is written at the end of the file
+//   when the capture is closed.
+//
+
+u08 cap_buf[CAP_MAX_CHUNK];      // chunk being built
+u32 cap_count;
+unsigned cap_port;
+double cap_t0;                   // GetMsecs() at the start of the session
+double cap_msecs;                // arrival time of the first byte in cap_buf
+double cap_last;                 // arrival time of the last byte in cap_buf
+double cap_jd0;                  // UTC at the start of the session
+double cap_next_index;           // session time of the next seek index entry
+u64 cap_file_size;               // bytes in the capture file
+struct CAP_INDEX_ENTRY *cap_index;
+u32 cap_index_count;
+u32 cap_index_size;
+
+int capture_name(char *name)
+{
+   // returns 1 if the file name is an indexed raw capture file
+
+   if(name == 0) return 0;
+   if(strstr(name, ".hrc") || strstr(name, ".HRC")) return 1;
+   return 0;
+}
+
+void add_capture_index(u64 offset, double jd)
+{
+struct CAP_INDEX_ENTRY *p;
+u32 size;
+
+   if(cap_index_count >= cap_index_size) {
+      size = cap_index_size ? (cap_index_size * 2) : 1024;
+      p = (struct CAP_INDEX_ENTRY *) realloc(cap_index, size * sizeof(struct CAP_INDEX_ENTRY));
+      if(p == 0) return;   // index just gets coarser
+      cap_index = p;
+      cap_index_size = size;
+   }
+
+   cap_index[cap_index_count].offset = offset;
+   cap_index[cap_index_count].jd = jd;
+   ++cap_index_count;
+}
+
+u32 find_capture_index(FILE *file, u64 file_size)
+{
+struct CAP_CHUNK chunk;
+struct CAP_TRAILER_DATA trailer;
+
+   // locate the seek index of a capture file from its trailer.  Returns the
+   // number of index entries with the file positioned at the first one,  or
+   // 0 if the file has no trailer (the capture was not closed cleanly).
+
+   if(file_size < (sizeof(struct CAP_HEADER) + sizeof(chunk) + sizeof(trailer))) return 0;
+
+   if(fseek(file, (long) (file_size - sizeof(chunk) - sizeof(trailer)), SEEK_SET)) return 0;
+   if(fread(&chunk, sizeof(chunk), 1, file) != 1) return 0;
+   if((chunk.id != CAP_CHUNK_ID) || (chunk.port != CAP_TRAILER)) return 0;
+   if(fread(&trailer, sizeof(trailer), 1, file) != 1) return 0;
+   if(trailer.index_offset >= file_size) return 0;
+
+   if(fseek(file, (long) trailer.index_offset, SEEK_SET)) return 0;
+   if(fread(&chunk, sizeof(chunk), 1, file) != 1) return 0;
+   if((chunk.id != CAP_CHUNK_ID) || (chunk.port != CAP_INDEX)) return 0;
+   if(chunk.count != (trailer.count * sizeof(struct CAP_INDEX_ENTRY))) return 0;
+
+   return trailer.count;
+}
+
+int read_capture_index(FILE *file, u64 file_size)
+{
+struct CAP_INDEX_ENTRY e;
+u32 count;
+u32 i;
+
+   // load the seek index of a capture file into cap_index
+
+   cap_index_count = 0;
+   count = find_capture_index(file, file_size);
+   if(count == 0) return 0;
+
+   for(i=0; i<count; i++) {
+      if(fread(&e, sizeof(e), 1, file) != 1) return 0;
+      add_capture_index(e.offset, e.jd);
+   }
+   return 1;
+}
+
+int get_capture_index(char *name)
+{
+FILE *file;
+struct CAP_HEADER h;
+struct CAP_CHUNK chunk;
+double next;
+long size;
+
+   // prepare to append to a capture file:  find its size and load its seek
+   // index.  The old index and trailer chunks stay in the file and are
+   // skipped over by the reader.  Returns 0 if the file exists but is not a
+   // capture file,  it must be opened in "w" mode (appending chunks to it
+   // would make a file that can't be replayed).
+
+   cap_file_size = 0;
+   cap_index_count = 0;
+
+   file = topen(name, "rb");
+   if(file == 0) return 1;
+
+   fseek(file, 0L, SEEK_END);
+   size = ftell(file);
+   if(size > 0) {
+      cap_file_size = (u64) size;
+      fseek(file, 0L, SEEK_SET);
+      if((fread(&h, sizeof(h), 1, file) != 1) || memcmp(h.magic, CAP_MAGIC, 8)) {
+         fclose(file);
+         if(debug_file) fprintf(debug_file, "! %s is not a capture file,  it will be overwritten\n", name);
+         return 0;  // not a capture file,  it will be overwritten
+      }
+      else if(read_capture_index(file, cap_file_size) == 0) {
+         // no trailer,  rebuild the index by walking the chunks
+         fseek(file, (long) sizeof(h), SEEK_SET);
+         cap_file_size = sizeof(h);
+         next = 0.0;
+         while(fread(&chunk, sizeof(chunk), 1, file) == 1) {
+            if(chunk.id != CAP_CHUNK_ID) break;
+            if(chunk.count > (u64) size) break;
+            if(cap_file_size + sizeof(chunk) + chunk.count > (u64) size) break;
+            if(chunk.port == CAP_SESSION) {
+               if(fread(&h.start_jd, sizeof(double), 1, file) != 1) break;
+               add_capture_index(cap_file_size, h.start_jd);
+               next = CAP_INDEX_SECS * 1000.0;
+            }
+            else {
+               if((chunk.port < CAP_SESSION) && (chunk.msecs >= next)) {
+                  add_capture_index(cap_file_size, h.start_jd + chunk.msecs / (24.0*60.0*60.0*1000.0));
+                  next = chunk.msecs + CAP_INDEX_SECS * 1000.0;
+               }
+               if(fseek(file, (long) chunk.count, SEEK_CUR)) break;
+            }
+            cap_file_size += sizeof(chunk) + chunk.count;  // drops any torn chunk at the end
+         }
+      }
+   }
+
+   fclose(file);
+
+   if(cap_file_size == 0) return 1;
+   if(cap_file_size != (u64) size) {  // chop off the torn chunk
+      #ifdef WINDOWS
+      #else
+         truncate(name, (off_t) cap_file_size);
+      #endif
+   }
+   return 1;
+}
+
+void put_capture_chunk(unsigned port, void *data, u32 count, double msecs)
+{
+struct CAP_CHUNK chunk;
+
+   if(raw_file == 0) return;
+
+   memset(&chunk, 0, sizeof(chunk));
+   chunk.id = CAP_CHUNK_ID;
+   chunk.port = (u16) port;
+   chunk.count = count;
+   chunk.msecs = msecs;
+
+   fwrite(&chunk, sizeof(chunk), 1, raw_file);
+   if(count) fwrite(data, 1, count, raw_file);
+   cap_file_size += sizeof(chunk) + count;
+}
+
+void flush_capture_chunk()
+{
+   // write out the receiver data chunk being built
+
+   if(cap_count == 0) return;
+
+   if(cap_msecs >= cap_next_index) {
+      add_capture_index(cap_file_size, cap_jd0 + cap_msecs / (24.0*60.0*60.0*1000.0));
+      cap_next_index = cap_msecs + CAP_INDEX_SECS * 1000.0;
+   }
+
+   put_capture_chunk(cap_port, &cap_buf[0], cap_count, cap_msecs);
+   cap_count = 0;
+
+   if(raw_flush_mode) fflush(raw_file);
+}
+
+void capture_flush_tick()
+{
+   // In flush mode write out the chunk being built once its bytes have
+   // stopped arriving,  rather than when the next byte shows up.  Called
+   // every time the screen data is updated.
+
+   if(raw_file == 0) return;
+   if(raw_capture == 0) return;
+   if(raw_flush_mode == 0) return;
+   if(cap_count == 0) return;
+   if(((GetMsecs() - cap_t0) - cap_last) < CAP_GAP_MSECS) return;
+
+   flush_capture_chunk();
+}
+
+void start_raw_capture(FILE *file)
+{
+struct CAP_HEADER h;
+
+   // start a capture session on a newly opened raw_file
+
+   raw_capture = 1;
+   cap_count = 0;
+   cap_next_index = 0.0;
+   cap_t0 = GetMsecs();
+   get_clock_time();
+   cap_jd0 = clk_jd;
+
+   if(cap_file_size == 0) {  // new file
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, CAP_MAGIC, 8);
+      h.endian = CAP_ENDIAN;
+      h.version = CAP_VERSION;
+      h.rcvr_type = rcvr_type;
+      h.start_jd = cap_jd0;
+      fwrite(&h, sizeof(h), 1, file);
+      cap_file_size = sizeof(h);
+      cap_index_count = 0;
+   }
+   else {  // appending: mark the time discontinuity
+      add_capture_index(cap_file_size, cap_jd0);
+      put_capture_chunk(CAP_SESSION, &cap_jd0, sizeof(cap_jd0), 0.0);
+      cap_next_index = CAP_INDEX_SECS * 1000.0;
+   }
+}
+
+void capture_raw_byte(unsigned port, u08 c)
+{
+double t;
+
+   // add a received byte to the capture file.  Bytes that arrive together
+   // share a chunk and its timestamp.
+
+   if(raw_file == 0) return;
+
+   t = GetMsecs() - cap_t0;
+   if(cap_count) {
+      if((cap_count >= CAP_MAX_CHUNK) || (port != cap_port) || ((t - cap_last) >= CAP_GAP_MSECS)) {
+         flush_capture_chunk();
+      }
+   }
+   if(cap_count == 0) {
+      cap_msecs = t;
+      cap_port = port;
+   }
+
+   cap_buf[cap_count++] = c;
+   cap_last = t;
+}
+
+void close_raw_file()
+{
+struct CAP_TRAILER_DATA trailer;
+u64 index_offset;
+
+   // close the raw receiver data capture file.  Capture files get their
+   // seek index and trailer written at the end.
+
+   if(raw_file == 0) return;
+
+   if(raw_capture) {
+      flush_capture_chunk();
+
+      index_offset = cap_file_size;
+      put_capture_chunk(CAP_INDEX, cap_index, cap_index_count * sizeof(struct CAP_INDEX_ENTRY), GetMsecs() - cap_t0);
+
+      memset(&trailer, 0, sizeof(trailer));
+      trailer.index_offset = index_offset;
+      trailer.count = cap_index_count;
+      put_capture_chunk(CAP_TRAILER, &trailer, sizeof(trailer), GetMsecs() - cap_t0);
+
+      if(cap_index) free(cap_index);
+      cap_index = 0;
+      cap_index_count = cap_index_size = 0;
+      raw_capture = 0;
+   }
+
+   fclose(raw_file);
+   raw_file = 0;
+}
+
+FILE *open_raw_file(char *name, char *mode)
+{
+char *s;
+FILE *file;
+
+   if(name == 0) return 0;
+   if(mode == 0) return 0;
+
+   close_raw_file();
+
+   s = strchr(name, FLUSH_CHAR);
+   if(s) {
+      *s = 0;
+      raw_flush_mode = 1;
+   }
+   else raw_flush_mode = 0;
+
+//lfs drain_port(RCVR_PORT);
+   wakeup_tsip_msg = 0;        // cause wait for full receiver message before logging raw data
+   saw_rcvr_msg = 0;
+   raw_capture = 0;
+   if(capture_name(name)) {
+      if(mode[0] != 'a') cap_file_size = 0;
+      else if(get_capture_index(name) == 0) mode = "wb";
+   }
+   file = async_topen(name, mode);
+   if(file) {
+      async_flush_flag(file, &raw_flush_mode);
+      if(debug_file) fprintf(debug_file, "! raw capture file %s opened\n", name);
+      if(capture_name(name)) start_raw_capture(file);
+   }
+   wakeup_tsip_msg = 0;        // cause wait for full receiver message before logging raw data
+   saw_rcvr_msg = 0;
+
+   return file;
+}
+
+FILE *open_prn_file(char *name, char *mode)
+{
+char *s;
+FILE *file;
+
+   if(name == 0) return 0;
+   if(mode == 0) return 0;
+
+   if(prn_file) {
+      fclose(prn_file);
+      prn_file = 0;
+      prn_count = 0;
+   }
+
+   s = strchr(name, FLUSH_CHAR);
+   if(s) {
+      *s = 0;
+      prn_flush_mode = 1;
+   }
+   else prn_flush_mode = 0;
+
+//lfs drain_port(RCVR_PORT);
+   file = async_topen(name, mode);
+   if(file) {
+      async_flush_flag(file, &prn_flush_mode);
+      fprintf(file, "#JD UTC         PRN   AZ     EL     SIG\n");
+      fprintf(file, "# 1\n");
+      if(prn_flush_mode) fflush(file);
+      prn_count = 1;
+      if(debug_file) fprintf(debug_file, "! PRN file %s opened\n", name);
+   }
+
+   return file;
+}
+
+//
+//
+//   Asynchronous log file writer
+//
+//
+//   Log files opened with async_topen() are stdio streams whose output goes
+//   into a ring buffer instead of the disk.  Each file has a writer thread
+//   that drains the ring with write() every ASYNC_LOG_MSECS (or sooner when
+//   data arrives) and does the fsync() calls,  so the main loop never waits
+//   on a slow SD card or network file system.  The ring has one producer 
+//   (the main thread) and one consumer (the writer) so the head and tail
+//   positions are handed across with atomic loads/stores and no lock.
+//   The main thread only waits if the ring fills up,  or if the file is in
+//   flush mode (log_flush_mode, raw_flush_mode, prn_flush_mode).  In flush
+//   mode each write waits until the writer has handed the data to the OS
+//   so a crash of the program does not lose it.  Write errors are reported
+//   by check_async_errors().
+//
+//   fsync policy (log_fsync_secs):
+//      <0 - never fsync,  leave it to the OS
+//       0 - fsync when sync_file() is called (hourly log syncs) (default)
+//      >0 - also fsync every # seconds if new data was written
+//
+//   Files whose name ends in .gz are gzip compressed by the writer thread
+//   (they always use the writer,  even if async_logs is off).  A zlib full
+//   flush point is written every GZ_BLOCK_SIZE bytes of log data and before
+//   every fsync,  so a crash only loses the data after the last flush point.
+//   Appending to a .gz file adds a new gzip member to it.  If the last member
+//   was cut off by a crash it is first finished at its last flush point by
+//   gz_repair(),  otherwise gzip would stop at the damaged member.
+//   The files can be read with gzip,  zcat,  or by Heather itself (see 
+//   ztopen()).
+//
+
+#ifdef ASYNC_LOG
+
+struct ASYNC_FILE {
+   FILE *file;              // the stdio stream the callers write to
+   int fd;
+   char *ring;
+   unsigned long head;      // bytes put into the ring (main thread)
+   unsigned long tail;      // bytes written to disk (writer thread)
+   int sync_req;            // fsync requested by sync_file()
+   int drain_req;           // producer is waiting for the ring to be written
+   int *flush_flag;         // the file's flush mode flag
+   int closing;
+   int err;                 // number of failed writes
+   int err_shown;           // errors that have been reported
+   char name[SLEN];
+   int gz;                  // gzip compress the file
+#ifdef USE_ZLIB
+   z_stream zs;
+   unsigned char *zbuf;     // compressor output buffer
+   long gz_in;              // bytes compressed since the last flush point
+#endif
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t wake;
+   pthread_cond_t drained;  // signaled when a drain request is done
+};
+
+struct ASYNC_FILE *async_files[MAX_ASYNC_FILES];
+
+int async_write_fd(struct ASYNC_FILE *a, char *buf, long len)
+{
+long n;
+
+   // write a buffer to the file.  Returns 0 if all written.
+
+   while(len > 0) {
+      n = (long) write(a->fd, buf, (size_t) len);
+      if(n < 0) {
+         if(errno == EINTR) continue;
+         return 1;
+      }
+      if(n == 0) return 1;
+      buf += n;
+      len -= n;
+   }
+   return 0;
+}
+
+int async_deflate(struct ASYNC_FILE *a, char *buf, long len, int flush)
+{
+#ifdef USE_ZLIB
+long n;
+
+   // compress data into a .gz file.  flush is Z_NO_FLUSH,  Z_FULL_FLUSH,
+   // or Z_FINISH.  Returns 0 if ok.
+
+   a->zs.next_in = (Bytef *) buf;
+   a->zs.avail_in = (uInt) len;
+   do {
+      a->zs.next_out = a->zbuf;
+      a->zs.avail_out = (uInt) GZ_BLOCK_SIZE;
+      if(deflate(&a->zs, flush) == Z_STREAM_ERROR) return 1;
+      n = GZ_BLOCK_SIZE - (long) a->zs.avail_out;
+      if(n && async_write_fd(a, (char *) a->zbuf, n)) return 1;
+   } while(a->zs.avail_out == 0);
+
+   if(flush == Z_NO_FLUSH) a->gz_in += len;
+   else                    a->gz_in = 0;
+#endif
+   return 0;
+}
+
+int async_write_data(struct ASYNC_FILE *a, char *buf, long len)
+{
+   // write ring buffer data to the file,  compressing it if need be
+
+#ifdef USE_ZLIB
+   if(a->gz) {
+      if(async_deflate(a, buf, len, Z_NO_FLUSH)) return 1;
+      if(a->gz_in >= GZ_BLOCK_SIZE) return async_deflate(a, 0, 0L, Z_FULL_FLUSH);
+      return 0;
+   }
+#endif
+   return async_write_fd(a, buf, len);
+}
+
+void async_flush_point(struct ASYNC_FILE *a)
+{
+   // make everything written so far decompressable
+
+#ifdef USE_ZLIB
+   if(a->gz && a->gz_in) {
+      if(async_deflate(a, 0, 0L, Z_FULL_FLUSH)) __atomic_add_fetch(&a->err, 1, __ATOMIC_RELEASE);
+   }
+#endif
+}
+
+void *async_writer(void *arg)
+{
+struct ASYNC_FILE *a;
+struct timespec ts;
+struct timeval tv;
+unsigned long h, t;
+long chunk;
+long n;
+double last_sync;
+double now;
+int dirty;
+int sync;
+int drain;
+
+   // writer thread:  batch the ring buffer contents out to the file
+
+   a = (struct ASYNC_FILE *) arg;
+   gettimeofday(&tv, 0);
+   last_sync = (double) tv.tv_sec;
+   dirty = 0;
+
+   while(1) {
+      pthread_mutex_lock(&a->lock);
+      h = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE);
+      if((h == a->tail) && (a->closing == 0) && (a->drain_req == 0) && (__atomic_load_n(&a->sync_req, __ATOMIC_ACQUIRE) == 0)) {
+         gettimeofday(&tv, 0);
+         ts.tv_sec = tv.tv_sec;
+         ts.tv_nsec = (tv.tv_usec * 1000L) + (ASYNC_LOG_MSECS * 1000000L);
+         ts.tv_sec += ts.tv_nsec / 1000000000L;
+         ts.tv_nsec %= 1000000000L;
+         pthread_cond_timedwait(&a->wake, &a->lock, &ts);
+      }
+      drain = a->drain_req;
+      pthread_mutex_unlock(&a->lock);
+
+      // take the sync request before looking at the ring so the data that
+      // was put in before the request gets written before the fsync
+      sync = __atomic_exchange_n(&a->sync_req, 0, __ATOMIC_ACQ_REL);
+
+      h = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE);
+      t = a->tail;
+      while(t != h) {
+         chunk = (long) (h - t);
+         n = ASYNC_LOG_SIZE - (long) (t & (ASYNC_LOG_SIZE-1));
+         if(chunk > n) chunk = n;   // up to the end of the ring
+
+         if(async_write_data(a, &a->ring[t & (ASYNC_LOG_SIZE-1)], chunk)) {
+            __atomic_add_fetch(&a->err, 1, __ATOMIC_RELEASE);  // can't write,  drop the data rather than block the producer
+            t = h;
+         }
+         else t += (unsigned long) chunk;
+         __atomic_store_n(&a->tail, t, __ATOMIC_RELEASE);
+         dirty = 1;
+      }
+
+      if(drain) {  // flush mode: the data is with the OS,  let the producer go
+         async_flush_point(a);
+         pthread_mutex_lock(&a->lock);
+         if(a->tail == __atomic_load_n(&a->head, __ATOMIC_ACQUIRE)) {
+            a->drain_req = 0;
+            pthread_cond_broadcast(&a->drained);
+         }
+         pthread_mutex_unlock(&a->lock);
+      }
+
+      gettimeofday(&tv, 0);
+      now = (double) tv.tv_sec;
+      if(sync) {
+         async_flush_point(a);
+         if(log_fsync_secs >= 0) fsync(a->fd);
+         last_sync = now;
+         dirty = 0;
+      }
+      else if(dirty && (log_fsync_secs > 0) && ((now - last_sync) >= (double) log_fsync_secs)) {
+         async_flush_point(a);
+         fsync(a->fd);
+         last_sync = now;
+         dirty = 0;
+      }
+
+      if(a->closing && (a->tail == __atomic_load_n(&a->head, __ATOMIC_ACQUIRE))) break;
+   }
+
+#ifdef USE_ZLIB
+   if(a->gz) {  // write the end of the gzip stream
+      if(async_deflate(a, 0, 0L, Z_FINISH)) __atomic_add_fetch(&a->err, 1, __ATOMIC_RELEASE);
+   }
+#endif
+   if(log_fsync_secs >= 0) fsync(a->fd);
+
+   pthread_mutex_lock(&a->lock);  // release any producer waiting on a drain
+   a->drain_req = 0;
+   pthread_cond_broadcast(&a->drained);
+   pthread_mutex_unlock(&a->lock);
+   return 0;
+}
+
+long async_put(struct ASYNC_FILE *a, const char *buf, long len)
+{
+unsigned long h, t;
+long space;
+long done;
+long n;
+long ofs;
+
+   // copy data into the ring buffer,  only waits if the ring is full
+
+   done = 0;
+   while(done < len) {
+      h = a->head;
+      t = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+      space = ASYNC_LOG_SIZE - (long) (h - t);
+      if(space <= 0) {  // ring is full,  wait for the writer to catch up
+         ++async_log_stalls;
+         pthread_cond_signal(&a->wake);
+         usleep(1000);
+         continue;
+      }
+
+      n = len - done;
+      if(n > space) n = space;
+      ofs = (long) (h & (ASYNC_LOG_SIZE-1));
+      if(n > (ASYNC_LOG_SIZE - ofs)) n = ASYNC_LOG_SIZE - ofs;
+      memcpy(&a->ring[ofs], &buf[done], (size_t) n);
+      __atomic_store_n(&a->head, h + (unsigned long) n, __ATOMIC_RELEASE);
+      done += n;
+   }
+
+   if(a->flush_flag && *a->flush_flag) {  // flush mode,  wait for the writer to write it
+      pthread_mutex_lock(&a->lock);
+      a->drain_req = 1;
+      pthread_cond_signal(&a->wake);
+      while(a->drain_req) pthread_cond_wait(&a->drained, &a->lock);
+      pthread_mutex_unlock(&a->lock);
+   }
+   else pthread_cond_signal(&a->wake);
+   return len;
+}
+
+int async_close(struct ASYNC_FILE *a)
+{
+int i;
+
+   // drain the ring and stop the writer thread
+
+   pthread_mutex_lock(&a->lock);
+   a->closing = 1;
+   pthread_cond_signal(&a->wake);
+   pthread_mutex_unlock(&a->lock);
+   pthread_join(a->thread, 0);
+
+   for(i=0; i<MAX_ASYNC_FILES; i++) {
+      if(async_files[i] == a) async_files[i] = 0;
+   }
+
+   i = close(a->fd);
+   if(a->err) {
+      if(debug_file) fprintf(debug_file, "async log %s: %d write errors\n", a->name, a->err);
+      i = (-1);
+   }
+   pthread_cond_destroy(&a->wake);
+   pthread_cond_destroy(&a->drained);
+   pthread_mutex_destroy(&a->lock);
+#ifdef USE_ZLIB
+   if(a->gz) {
+      deflateEnd(&a->zs);
+      free(a->zbuf);
+   }
+#endif
+   free(a->ring);
+   free(a);
+   return i;
+}
+
+#ifdef __linux__
+ssize_t async_cookie_write(void *cookie, const char *buf, size_t len)
+{
+   return (ssize_t) async_put((struct ASYNC_FILE *) cookie, buf, (long) len);
+}
+
+int async_cookie_close(void *cookie)
+{
+   return async_close((struct ASYNC_FILE *) cookie);
+}
+#else  // __MACH__  __FreeBSD__
+int async_cookie_write(void *cookie, const char *buf, int len)
+{
+   return (int) async_put((struct ASYNC_FILE *) cookie, buf, (long) len);
+}
+
+int async_cookie_close(void *cookie)
+{
+   return async_close((struct ASYNC_FILE *) cookie);
+}
+#endif
+
+#ifdef USE_ZLIB
+int gz_repair(char *name)
+{
+FILE *file;
+int fd;
+z_stream zs;
+unsigned char *ibuf;
+unsigned char *obuf;
+unsigned char tail[10];
+long n;
+long pos;            // file offset of the data in ibuf
+long member;         // file offset of the current gzip member
+long cut;            // file offset of the last byte aligned block boundary
+unsigned long crc;   // crc and length of the data before the cut
+unsigned long len;
+unsigned long cut_crc;
+unsigned long cut_len;
+int last;            // last data byte before the cut
+int cut_last;
+int status;
+int i;
+
+   // Check the last gzip member of a .gz file that is going to be appended
+   // to.  If the program died while writing it,  the member has no end
+   // block or trailer and gzip/zcat will choke on the file once new data
+   // is added after it.  The member is cut back to its last block boundary
+   // (the flush points written by the async writer are byte aligned) and
+   // finished off with an empty final block and the trailer.
+   //
+   // Returns 0 if the file is ok (or does not exist),  1 if it was repaired,
+   // 2 if it was repaired and the saved data ends in a partial line,  and -1
+   // if it could not be checked.
+
+   file = topen(name, "r+b");
+   if(file == 0) return 0;
+   fd = fileno(file);
+
+   ibuf = (unsigned char *) malloc(GZ_BLOCK_SIZE);
+   obuf = (unsigned char *) malloc(GZ_BLOCK_SIZE);
+   memset(&zs, 0, sizeof(zs));
+   if((ibuf == 0) || (obuf == 0) || (inflateInit2(&zs, 15+16) != Z_OK)) {
+      if(ibuf) free(ibuf);
+      if(obuf) free(obuf);
+      fclose(file);
+      return (-1);
+   }
+
+   pos = member = cut = 0;
+   crc = crc32(0L, Z_NULL, 0);
+   len = cut_crc = cut_len = 0;
+   last = cut_last = '\n';
+   status = Z_OK;
+   zs.next_in = ibuf;
+   zs.avail_in = 0;
+
+   while(1) {
+      if(zs.avail_in == 0) {
+         pos += (long) (zs.next_in - ibuf);
+         n = (long) read(fd, ibuf, (size_t) GZ_BLOCK_SIZE);
+         if(n <= 0) break;
+         zs.next_in = ibuf;
+         zs.avail_in = (uInt) n;
+      }
+
+      zs.next_out = obuf;
+      zs.avail_out = (uInt) GZ_BLOCK_SIZE;
+      status = inflate(&zs, Z_BLOCK);
+      n = GZ_BLOCK_SIZE - (long) zs.avail_out;
+      if(n) {
+         crc = crc32(crc, obuf, (uInt) n);
+         len += (unsigned long) n;
+         last = obuf[n-1];
+      }
+
+      if(status == Z_STREAM_END) {  // member is complete,  look for another one
+         member = pos + (long) (zs.next_in - ibuf);
+         cut = member;
+         crc = crc32(0L, Z_NULL, 0);
+         len = cut_crc = cut_len = 0;
+         last = cut_last = '\n';
+         inflateReset(&zs);
+         continue;
+      }
+      if((status != Z_OK) && (status != Z_BUF_ERROR)) break;  // corrupted data
+
+      if((zs.data_type & 0x80) && ((zs.data_type & 0x47) == 0)) {
+         cut = pos + (long) (zs.next_in - ibuf);  // at a byte aligned block boundary
+         cut_crc = crc;
+         cut_len = len;
+         cut_last = last;
+      }
+   }
+
+   pos = (long) lseek(fd, 0L, SEEK_END);
+   i = 0;
+   if((member < pos) && (status != Z_STREAM_END)) {  // last member is not complete
+      if(cut <= member) n = member;  // nothing to save,  drop the member
+      else {
+         n = cut;
+         tail[0] = 0x03;  // empty final fixed huffman block
+         tail[1] = 0x00;
+         for(i=0; i<4; i++) {
+            tail[2+i] = (unsigned char) (cut_crc >> (i*8));
+            tail[6+i] = (unsigned char) (cut_len >> (i*8));
+         }
+      }
+
+      if(ftruncate(fd, (off_t) n)) i = (-1);
+      else if((n == cut) && (cut > member)) {
+         lseek(fd, (off_t) n, SEEK_SET);
+         if(write(fd, tail, sizeof(tail)) != (ssize_t) sizeof(tail)) i = (-1);
+         else if(cut_last != '\n') i = 2;
+         else i = 1;
+      }
+      else i = 1;
+
+      if(debug_file) fprintf(debug_file, "gz_repair(%s): unfinished gzip member cut from %ld to %ld bytes\n", name, pos, n);
+   }
+
+   inflateEnd(&zs);
+   free(ibuf);
+   free(obuf);
+   fclose(file);
+   return i;
+}
+#endif  // USE_ZLIB
+
+#endif  // ASYNC_LOG
+
+FILE *async_topen(char *name, char *mode)
+{
+FILE *file;
+#ifdef ASYNC_LOG
+struct ASYNC_FILE *a;
+int slot;
+int i;
+int gz;
+int repaired;
+#ifdef __linux__
+cookie_io_functions_t io;
+#endif
+#endif
+
+   // open a log file for writing through the async log writer.  If the
+   // writer can't be used the normal stdio stream is returned.
+
+#ifdef ASYNC_LOG
+   repaired = 0;
+   #ifdef USE_ZLIB
+      if((mode[0] == 'a') && gz_name(name)) repaired = gz_repair(name);
+   #endif
+#endif
+
+   file = topen(name, mode);
+   if(file == 0) return 0;
+
+#ifdef ASYNC_LOG
+   if((mode[0] != 'w') && (mode[0] != 'a')) return file;
+   if(strchr(mode, '+')) return file;
+   #ifdef USE_ZLIB
+      gz = gz_name(name);
+   #else
+      gz = 0;   // no zlib,  .gz files are written uncompressed
+   #endif
+   if((async_logs == 0) && (gz == 0)) return file;
+
+   slot = (-1);
+   for(i=0; i<MAX_ASYNC_FILES; i++) {
+      if(async_files[i] == 0) {
+         slot = i;
+         break;
+      }
+   }
+   if(slot < 0) return file;
+
+   a = (struct ASYNC_FILE *) calloc(1, sizeof(struct ASYNC_FILE));
+   if(a == 0) return file;
+   a->ring = (char *) malloc(ASYNC_LOG_SIZE);
+   if(a->ring == 0) {
+      free(a);
+      return file;
+   }
+
+   #ifdef USE_ZLIB
+      if(gz) {  // gzip stream,  appending adds a new gzip member to the file
+         a->zbuf = (unsigned char *) malloc(GZ_BLOCK_SIZE);
+         if((a->zbuf == 0) || (deflateInit2(&a->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)) {
+            if(a->zbuf) free(a->zbuf);
+            free(a->ring);
+            free(a);
+            return file;
+         }
+         a->gz = 1;
+      }
+   #endif
+
+   fflush(file);
+   a->fd = dup(fileno(file));  // the dup keeps the O_APPEND mode of "a" files
+   if(a->fd < 0) {
+      #ifdef USE_ZLIB
+         if(a->gz) {
+            deflateEnd(&a->zs);
+            free(a->zbuf);
+         }
+      #endif
+      free(a->ring);
+      free(a);
+      return file;
+   }
+
+   strncpy(a->name, name, sizeof(a->name)-1);
+   pthread_mutex_init(&a->lock, 0);
+   pthread_cond_init(&a->wake, 0);
+   pthread_cond_init(&a->drained, 0);
+   if(pthread_create(&a->thread, 0, async_writer, a)) {
+      close(a->fd);
+      pthread_cond_destroy(&a->wake);
+      pthread_cond_destroy(&a->drained);
+      pthread_mutex_destroy(&a->lock);
+      #ifdef USE_ZLIB
+         if(a->gz) {
+            deflateEnd(&a->zs);
+            free(a->zbuf);
+         }
+      #endif
+      free(a->ring);
+      free(a);
+      return file;
+   }
+
+   #ifdef __linux__
+      io.read = 0;
+      io.write = async_cookie_write;
+      io.seek = 0;
+      io.close = async_cookie_close;
+      a->file = fopencookie(a, "w", io);
+   #else
+      a->file = funopen(a, 0, async_cookie_write, 0, async_cookie_close);
+   #endif
+
+   if(a->file == 0) {  // could not make the stream,  stop the writer and use the plain file
+      async_close(a);
+      if(gz) {  // the writer started a gzip stream in the file
+         fclose(file);
+         return 0;
+      }
+      return file;
+   }
+
+   fclose(file);
+   async_files[slot] = a;
+   if(repaired == 2) fprintf(a->file, "\n");  // end the partial line that survived the repair
+   if(debug_file) fprintf(debug_file, "async log writer started for %s\n", name);
+   return a->file;
+#else
+   return file;
+#endif
+}
+
+int async_sync(FILE *file)
+{
+#ifdef ASYNC_LOG
+int i;
+
+   // ask the writer thread to fsync an async log file.  Returns 1 if file
+   // is an async log file.
+
+   if(file == 0) return 0;
+   for(i=0; i<MAX_ASYNC_FILES; i++) {
+      if(async_files[i] && (async_files[i]->file == file)) {
+         __atomic_store_n(&async_files[i]->sync_req, 1, __ATOMIC_RELEASE);
+         pthread_cond_signal(&async_files[i]->wake);
+         return 1;
+      }
+   }
+#endif
+   return 0;
+}
+
+void async_flush_flag(FILE *file, int *flag)
+{
+#ifdef ASYNC_LOG
+int i;
+
+   // tie an async log file to its flush mode flag
+
+   if(file == 0) return;
+   for(i=0; i<MAX_ASYNC_FILES; i++) {
+      if(async_files[i] && (async_files[i]->file == file)) {
+         async_files[i]->flush_flag = flag;
+         return;
+      }
+   }
+#endif
+}
+
+void check_async_errors()
+{
+#ifdef ASYNC_LOG
+struct ASYNC_FILE *a;
+int err;
+int i;
+
+   // report any new write errors from the log writer threads
+
+   for(i=0; i<MAX_ASYNC_FILES; i++) {
+      a = async_files[i];
+      if(a == 0) continue;
+      err = __atomic_load_n(&a->err, __ATOMIC_ACQUIRE);
+      if(err == a->err_shown) continue;
+
+      if(debug_file) fprintf(debug_file, "async log %s: %d write errors\n", a->name, err);
+      if(a->err_shown == 0) {  // only pop up the first one
+         sprintf(out, "Error writing file: %s", a->name);
+         edit_error(out);
+      }
+      a->err_shown = err;
+   }
+#endif
+}
+
+//
+//
+//   Live metrics web server (/ws)
+//
+//
+//   The /ws command line option starts a small web server thread that
+//   serves the current receiver state in the Prometheus text exposition
+//   format,  so that many copies of Heather can be watched from one place.
+//   The main thread copies the values it wants to show into a METRICS
+//   snapshot once per second (publish_metrics() from update_plot_data()).
+//   The snapshot is guarded by a sequence lock:  the writer makes the
+//   sequence count odd while it updates the snapshot and the server thread
+//   copies the snapshot and retries if the count changed.  The main thread
+//   never waits on a scrape,  and a slow client only delays the server
+//   thread.
+//
+//   Requests for "/metrics" (or "/") get the metrics page,  anything else
+//   gets a 404.  The server only binds to the localhost address unless an
+//   address is given with /ws=addr:port.
+//
+
+#ifdef METRICS_HTTP
+
+struct METRICS metrics_snap;   // the published snapshot
+int metrics_fd = (-1);         // server listen socket
+int metrics_stop;              // flag set to stop the server thread
+pthread_t metrics_thread;
+char *metrics_text;            // the page being built by the server thread
+long metrics_len;
+
+void publish_metrics()
+{
+struct METRICS *m;
+struct timeval tv;
+u32 seq;
+int port;
+#ifdef ADEV_STUFF
+struct BIN *table;
+static struct ADEV_INFO info;
+char *chan;
+char *type;
+long count;
+double period;
+int i, j, k;
+#endif
+
+   // copy the latest receiver state into the metrics snapshot
+
+   if(metrics_fd < 0) return;
+
+   m = &metrics_snap;
+   seq = m->seq;
+   __atomic_store_n(&m->seq, seq+1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   gettimeofday(&tv, 0);
+   m->unix_time = (double) tv.tv_sec + ((double) tv.tv_usec / 1.0E6);
+   m->pps_offset = pps_offset;
+   m->osc_offset = osc_offset;
+   m->dac_voltage = (double) dac_voltage;
+   m->temperature = (double) temperature;
+   m->have_pps_offset = have_pps_offset;
+   m->have_osc_offset = have_osc_offset;
+   m->have_dac = have_dac;
+   m->have_temperature = have_temperature;
+   m->sat_count = sat_count;
+   m->discipline_mode = discipline_mode;
+   m->holdover = holdover;
+   m->holdover_seen = holdover_seen;
+   m->minor_alarms = minor_alarms;
+   m->critical_alarms = critical_alarms;
+   m->packet_count = packet_count;
+   m->bad_packets = bad_packets;
+   m->math_errors = math_errors;
+   m->com_errors = com_errors;
+   for(port=0; port<NUM_COM_PORTS; port++) {
+      m->com_running[port] = (com[port].com_running > 0);
+      m->com_error[port] = com[port].com_error;
+      m->com_data_lost[port] = com[port].com_data_lost;
+   }
+
+#ifdef ADEV_STUFF
+   for(i=0; i<METRIC_CHANS; i++) {  // OSC, PPS, chC, chD in adev_type order
+      info.adev_type = (u08) (i*NUM_ADEV_TYPES);
+      adev_table_info(&info, &chan, &type, &count, &period);
+      strncpy(m->chan_id[i], chan, sizeof(m->chan_id[i])-1);
+      m->chan_id[i][sizeof(m->chan_id[i])-1] = 0;
+
+      for(j=0; j<METRIC_XDEVS; j++) {
+         if     (i == PPS_ID) table = (j == 0) ? pps_adev_bins : (j == 1) ? pps_hdev_bins : (j == 2) ? pps_mdev_bins : pps_tdev_bins;
+         else if(i == CHC_ID) table = (j == 0) ? chc_adev_bins : (j == 1) ? chc_hdev_bins : (j == 2) ? chc_mdev_bins : chc_tdev_bins;
+         else if(i == CHD_ID) table = (j == 0) ? chd_adev_bins : (j == 1) ? chd_hdev_bins : (j == 2) ? chd_mdev_bins : chd_tdev_bins;
+         else                 table = (j == 0) ? osc_adev_bins : (j == 1) ? osc_hdev_bins : (j == 2) ? osc_mdev_bins : osc_tdev_bins;
+
+         for(k=0; k<MAX_ADEV_BINS; k++) {  // same cutoff as fetch_adev_info()
+            if(table[k].n < min_points_per_bin) break;
+            m->tau[i][j][k] = (float) table[k].tau;
+            m->xdev[i][j][k] = (float) table[k].value;
+            m->points[i][j][k] = (long) table[k].n;
+         }
+         m->bin_count[i][j] = k;
+      }
+   }
+#endif
+
+   __atomic_store_n(&m->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+int read_metrics(struct METRICS *m)
+{
+u32 s1, s2;
+int tries;
+
+   // get a consistent copy of the metrics snapshot (server thread).
+   // Returns 0 if the main thread kept changing it.
+
+   for(tries=0; tries<100; tries++) {
+      s1 = __atomic_load_n(&metrics_snap.seq, __ATOMIC_ACQUIRE);
+      if(s1 & 1) {  // being updated
+         sched_yield();
+         continue;
+      }
+      memcpy(m, &metrics_snap, sizeof(struct METRICS));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      s2 = __atomic_load_n(&metrics_snap.seq, __ATOMIC_RELAXED);
+      if(s1 == s2) return 1;
+   }
+   return 0;
+}
+
+void metric_out(char *fmt, ...)
+{
+va_list args;
+long n;
+
+   // add text to the metrics page
+
+   if(metrics_len >= (METRICS_TEXT_SIZE-1)) return;
+   va_start(args, fmt);
+   n = (long) vsnprintf(&metrics_text[metrics_len], (size_t) (METRICS_TEXT_SIZE-metrics_len), fmt, args);
+   va_end(args);
+   if(n < 0) return;
+   metrics_len += n;
+   if(metrics_len >= METRICS_TEXT_SIZE) metrics_len = METRICS_TEXT_SIZE-1;
+}
+
+void metric_head(char *name, char *type, char *help)
+{
+   metric_out("# HELP heather_%s %s\n", name, help);
+   metric_out("# TYPE heather_%s %s\n", name, type);
+}
+
+long format_metrics()
+{
+static struct METRICS m;
+int port;
+#ifdef ADEV_STUFF
+static char *xdev_name[METRIC_XDEVS] = { "ADEV", "HDEV", "MDEV", "TDEV" };
+int i, j, k;
+int any;
+#endif
+
+   // build the metrics page from a copy of the snapshot
+
+   metrics_len = 0;
+   metrics_text[0] = 0;
+   if(read_metrics(&m) == 0) return 0;
+   if(m.seq == 0) return 0;  // nothing published yet
+
+   metric_head("last_update_seconds", "gauge", "Unix time of the latest receiver data");
+   metric_out("heather_last_update_seconds %.3f\n", m.unix_time);
+
+   if(m.have_pps_offset) {
+      metric_head("pps_offset", "gauge", "PPS offset in the receiver's units");
+      metric_out("heather_pps_offset %.9g\n", m.pps_offset);
+   }
+   if(m.have_osc_offset) {
+      metric_head("osc_offset", "gauge", "Oscillator offset in the receiver's units");
+      metric_out("heather_osc_offset %.9g\n", m.osc_offset);
+   }
+   if(m.have_dac) {
+      metric_head("dac_voltage", "gauge", "Oscillator control (DAC) value");
+      metric_out("heather_dac_voltage %.9g\n", m.dac_voltage);
+   }
+   if(m.have_temperature) {
+      metric_head("temperature", "gauge", "Receiver temperature");
+      metric_out("heather_temperature %.6g\n", m.temperature);
+   }
+
+   metric_head("satellites_used", "gauge", "Number of satellites being used");
+   metric_out("heather_satellites_used %d\n", m.sat_count);
+
+   metric_head("discipline_mode", "gauge", "Oscillator discipline mode (0=normal)");
+   metric_out("heather_discipline_mode %d\n", m.discipline_mode);
+   metric_head("holdover_active", "gauge", "1 if the oscillator is in holdover");
+   metric_out("heather_holdover_active %d\n", ((m.discipline_mode == DIS_MODE_AUTO_HOLD) || (m.discipline_mode == DIS_MODE_MANUAL_HOLD)) ? 1 : 0);
+   metric_head("holdover_seconds", "gauge", "Holdover time reported by the receiver");
+   metric_out("heather_holdover_seconds %lu\n", (unsigned long) m.holdover);
+   metric_head("holdover_seen", "gauge", "Holdover (1) or recovery (2) seen since startup");
+   metric_out("heather_holdover_seen %d\n", m.holdover_seen);
+
+   metric_head("minor_alarms", "gauge", "Receiver minor alarm bits");
+   metric_out("heather_minor_alarms %d\n", m.minor_alarms);
+   metric_head("critical_alarms", "gauge", "Receiver critical alarm bits");
+   metric_out("heather_critical_alarms %d\n", m.critical_alarms);
+
+   metric_head("packets_total", "counter", "Receiver messages processed");
+   metric_out("heather_packets_total %lu\n", (unsigned long) m.packet_count);
+   metric_head("bad_packets_total", "counter", "Receiver messages with errors");
+   metric_out("heather_bad_packets_total %lu\n", (unsigned long) m.bad_packets);
+   metric_head("math_errors_total", "counter", "Math errors seen");
+   metric_out("heather_math_errors_total %lu\n", (unsigned long) m.math_errors);
+   metric_head("com_errors_total", "counter", "Com port errors");
+   metric_out("heather_com_errors_total %lu\n", (unsigned long) m.com_errors);
+
+   metric_head("com_error", "gauge", "Last com port error (1=receive 2=transmit 4=init)");
+   for(port=0; port<NUM_COM_PORTS; port++) {
+      if(m.com_running[port] == 0) continue;
+      metric_out("heather_com_error{port=\"%d\"} %d\n", port, m.com_error[port]);
+   }
+   metric_head("com_data_lost", "gauge", "1 if the com port data stream has stopped");
+   for(port=0; port<NUM_COM_PORTS; port++) {
+      if(m.com_running[port] == 0) continue;
+      metric_out("heather_com_data_lost{port=\"%d\"} %d\n", port, m.com_data_lost[port]);
+   }
+
+#ifdef ADEV_STUFF
+   any = 0;
+   for(i=0; i<METRIC_CHANS; i++) {
+      for(j=0; j<METRIC_XDEVS; j++) {
+         if(m.bin_count[i][j] == 0) continue;
+         if(any == 0) {
+            metric_head("xdev", "gauge", "Current xDEV bin values");
+            any = 1;
+         }
+         for(k=0; k<m.bin_count[i][j]; k++) {
+            metric_out("heather_xdev{channel=\"%s\",type=\"%s\",tau=\"%g\"} %.6e\n",
+               m.chan_id[i], xdev_name[j], m.tau[i][j][k], m.xdev[i][j][k]);
+         }
+      }
+   }
+   if(any) {
+      metric_head("xdev_points", "gauge", "Number of points in each xDEV bin");
+      for(i=0; i<METRIC_CHANS; i++) {
+         for(j=0; j<METRIC_XDEVS; j++) {
+            for(k=0; k<m.bin_count[i][j]; k++) {
+               metric_out("heather_xdev_points{channel=\"%s\",type=\"%s\",tau=\"%g\"} %ld\n",
+                  m.chan_id[i], xdev_name[j], m.tau[i][j][k], m.points[i][j][k]);
+            }
+         }
+      }
+   }
+#endif
+
+   return metrics_len;
+}
+
+int metrics_send(int fd, char *buf, long len)
+{
+struct pollfd pfd;
+long n;
+
+   // send a reply to a client,  giving up if it stalls
+
+   while(len > 0) {
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      if(poll(&pfd, 1, 2000) <= 0) return 1;
+      n = (long) send(fd, buf, (size_t) len, MSG_NOSIGNAL);
+      if(n < 0) {
+         if((errno == EINTR) || (errno == EAGAIN)) continue;
+         return 1;
+      }
+      buf += n;
+      len -= n;
+   }
+   return 0;
+}
+
+void serve_metrics_client(int fd)
+{
+struct pollfd pfd;
+char req[1024+1];
+char hdr[256];
+long len;
+long n;
+char *status;
+
+   // read a request and send the metrics page
+
+   len = 0;
+   while(len < 1024) {  // read the request headers
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if(poll(&pfd, 1, 2000) <= 0) return;
+      n = (long) recv(fd, &req[len], (size_t) (1024-len), 0);
+      if(n < 0) {
+         if((errno == EINTR) || (errno == EAGAIN)) continue;
+         return;
+      }
+      if(n == 0) break;
+      len += n;
+      req[len] = 0;
+      if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+   }
+   req[len] = 0;
+
+   status = "404 Not Found";
+   len = 0;
+   if(!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET /metrics?", 13) || !strncmp(req, "GET / ", 6)) {
+      len = format_metrics();
+      if(len) status = "200 OK";
+      else    status = "503 Service Unavailable";
+   }
+   else if(strncmp(req, "GET ", 4)) {
+      status = "405 Method Not Allowed";
+   }
+
+   sprintf(hdr, "HTTP/1.0 %s\r\n"
+                "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                "Content-Length: %ld\r\n"
+                "Connection: close\r\n"
+                "\r\n", status, len);
+   if(metrics_send(fd, hdr, (long) strlen(hdr))) return;
+   if(len) metrics_send(fd, metrics_text, len);
+}
+
+void *metrics_server_thread(void *arg)
+{
+struct pollfd pfd;
+int fd;
+int x;
+
+   // accept and answer metrics requests one at a time
+
+   while(metrics_stop == 0) {
+      pfd.fd = metrics_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if(poll(&pfd, 1, 250) <= 0) continue;
+
+      fd = accept(metrics_fd, 0, 0);
+      if(fd < 0) continue;
+      x = fcntl(fd, F_GETFL, 0);
+      fcntl(fd, F_SETFL, x | O_NONBLOCK);
+      serve_metrics_client(fd);
+      close(fd);
+   }
+   return 0;
+}
+
+void start_metrics()
+{
+struct addrinfo hints;
+struct addrinfo *res;
+char addr[MAX_PATH+1];
+char port_string[32];
+char *host;
+char *s;
+int gai_err;
+int fd;
+int x;
+
+   // start the /ws metrics web server
+
+   if(metrics_server == 0) return;
+   if(metrics_fd >= 0) return;
+
+   strcpy(addr, metrics_addr);
+   host = "127.0.0.1";
+   sprintf(port_string, "%d", METRICS_PORT);
+   if(addr[0] == '[') {        // [ipv6]:port
+      host = &addr[1];
+      s = strchr(addr, ']');
+      if(s) {
+         *s++ = 0;
+         if(*s == ':') strncpy(port_string, s+1, sizeof(port_string)-1);
+      }
+   }
+   else if(addr[0]) {
+      s = strrchr(addr, ':');
+      if(s) {                  // addr:port
+         *s = 0;
+         if(addr[0]) host = addr;
+         if(*(s+1)) strncpy(port_string, s+1, sizeof(port_string)-1);
+      }
+      else if(strchr(addr, '.') == 0) {  // just a port number
+         strncpy(port_string, addr, sizeof(port_string)-1);
+      }
+      else host = addr;        // just an address
+   }
+   port_string[sizeof(port_string)-1] = 0;
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_PASSIVE;
+   gai_err = getaddrinfo(host, port_string, &hints, &res);
+   if(gai_err) {
+      printf("Metrics server: bad address %s:%s (%s)\n", host, port_string, gai_strerror(gai_err));
+      if(debug_file) fprintf(debug_file, "metrics server: bad address %s:%s\n", host, port_string);
+      return;
+   }
+
+   fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+   if(fd >= 0) {
+      x = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &x, sizeof(x));
+      if(bind(fd, res->ai_addr, res->ai_addrlen) || listen(fd, 8)) {
+         close(fd);
+         fd = (-1);
+      }
+   }
+   freeaddrinfo(res);
+   if(fd < 0) {
+      printf("Metrics server: could not listen on %s:%s (%s)\n", host, port_string, strerror(errno));
+      if(debug_file) fprintf(debug_file, "metrics server: could not listen on %s:%s\n", host, port_string);
+      return;
+   }
+
+   if(metrics_text == 0) metrics_text = (char *) malloc(METRICS_TEXT_SIZE);
+   if(metrics_text == 0) {
+      close(fd);
+      return;
+   }
+
+   metrics_fd = fd;
+   metrics_stop = 0;
+   publish_metrics();
+   if(pthread_create(&metrics_thread, 0, metrics_server_thread, 0)) {
+      close(metrics_fd);
+      metrics_fd = (-1);
+      return;
+   }
+   if(debug_file) fprintf(debug_file, "metrics server listening on %s:%s\n", host, port_string);
+}
+
+void stop_metrics()
+{
+   // stop the /ws metrics web server
+
+   if(metrics_fd < 0) return;
+   metrics_stop = 1;
+   pthread_join(metrics_thread, 0);
+   close(metrics_fd);
+   metrics_fd = (-1);
+}
+
+#else   // METRICS_HTTP
+
+void publish_metrics() { }
+void start_metrics() { }
+void stop_metrics() { }
+
+#endif  // METRICS_HTTP
+
+//
+//
+//   Shared memory live state (/wm)
+//
+//
+//   The /wm command line option publishes the receiver state in a POSIX
+//   shared memory segment (default name /heather,  /dev/shm/heather on 
+//   Linux) so that local programs can watch Heather without any IPC round
+//   trips.  The segment holds one SHM_STATE structure (see heather.ch) that
+//   is updated on every timing message.  A reader maps the segment read
+//   only and uses the seq field as a sequence lock:
+//
+//      do {
+//         s1 = state->seq;           (with acquire ordering)
+//         if(s1 & 1) continue;       (being updated)
+//         copy the fields it wants
+//         s2 = state->seq;           (after an acquire fence)
+//      } while(s1 != s2);
+//
+//   Readers should check magic,  version,  and size before using the
+//   segment.  Heather removes the segment when it exits.  The update_time
+//   field lets a reader notice if Heather stopped without removing it.
+//
+
+#ifdef SHM_PUBLISH
+
+struct SHM_STATE *shm_state;   // the mapped segment
+char shm_open_name[MAX_PATH+1];
+
+void publish_shm_state()
+{
+struct SHM_STATE *m;
+struct timeval tv;
+u32 seq;
+u32 have;
+int prn;
+int n;
+
+   // copy the latest receiver state into the shared memory segment
+
+   m = shm_state;
+   if(m == 0) return;
+
+   seq = m->seq;
+   __atomic_store_n(&m->seq, seq+1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   gettimeofday(&tv, 0);
+   m->update_time = (double) tv.tv_sec + ((double) tv.tv_usec / 1.0E6);
+   ++m->updates;
+   m->rcvr_type = rcvr_type;
+
+   have = 0;
+   if(have_time) have |= SHM_HAVE_TIME;
+   m->jd_utc = jd_utc;
+   m->jd_gps = jd_gps;
+   m->unix_time = (jd_utc - LINUX_EPOCH) * (24.0*60.0*60.0);
+   m->gps_week = gps_week;
+   m->tow = tow;
+   m->utc_offset = utc_offset;
+   m->time_flags = time_flags;
+
+   if(lat || lon) have |= SHM_HAVE_LLA;
+   m->lat = lat * RAD_TO_DEG;
+   m->lon = lon * RAD_TO_DEG;
+   m->alt = alt;
+
+   if(have_pps_offset)   have |= SHM_HAVE_PPS;
+   if(have_osc_offset)   have |= SHM_HAVE_OSC;
+   if(have_dac)          have |= SHM_HAVE_DAC;
+   if(have_temperature)  have |= SHM_HAVE_TEMP;
+   if(have_temperature1) have |= SHM_HAVE_TC1;
+   if(have_temperature2) have |= SHM_HAVE_TC2;
+   m->pps_offset = pps_offset;
+   m->osc_offset = osc_offset;
+   m->dac_voltage = (double) dac_voltage;
+   m->temperature = (double) temperature;
+   m->tc1 = (double) tc1;
+   m->tc2 = (double) tc2;
+   m->have = have;
+
+   m->discipline_mode = discipline_mode;
+   m->rcvr_mode = rcvr_mode;
+   m->gps_status = gps_status;
+   m->holdover = holdover;
+   m->critical_alarms = critical_alarms;
+   m->minor_alarms = minor_alarms;
+   m->leap_pending = leap_pending;
+
+   m->sats_used = m->sats_tracked = m->sats_visible = 0;
+   n = 0;
+   for(prn=1; prn<=MAX_PRN; prn++) {  // same rules as the sat count
+      if(sat[prn].level_msg == 0x00) continue;
+      ++m->sats_visible;
+      if(sat[prn].tracking > 0) ++m->sats_used;
+      if(sat[prn].tracking)     ++m->sats_tracked;
+      if(n >= SHM_SATS) continue;
+
+      m->sat[n].prn = prn;
+      m->sat[n].tracking = (sat[prn].tracking > 0) ? 1 : (sat[prn].tracking < 0) ? (-1) : 0;
+      m->sat[n].azimuth = sat[prn].azimuth;
+      m->sat[n].elevation = sat[prn].elevation;
+      m->sat[n].sig_level = sat[prn].sig_level;
+      m->sat[n].pad = 0.0F;
+      ++n;
+   }
+   m->sat_entries = n;
+
+   __atomic_store_n(&m->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+void start_shm_state()
+{
+struct SHM_STATE *m;
+int fd;
+
+   // create the /wm shared memory segment
+
+   if(shm_wanted == 0) return;
+   if(shm_state) return;
+
+   if(shm_name[0] == 0) strcpy(shm_name, SHM_NAME);
+   if(shm_name[0] == '/') strcpy(shm_open_name, shm_name);
+   else                   sprintf(shm_open_name, "/%s", shm_name);
+
+   fd = shm_open(shm_open_name, O_CREAT | O_RDWR, 0644);
+   if(fd < 0) {
+      printf("Could not create shared memory segment %s (%s)\n", shm_open_name, strerror(errno));
+      if(debug_file) fprintf(debug_file, "could not create shared memory segment %s\n", shm_open_name);
+      return;
+   }
+   if(ftruncate(fd, (off_t) sizeof(struct SHM_STATE))) {
+      close(fd);
+      shm_unlink(shm_open_name);
+      return;
+   }
 
-   rinex_file = topen(s, "w");
-   if(rinex_file) {
-      if(debug_file) fprintf(debug_file, "! RINEX file %s opened\n", s);
+   m = (struct SHM_STATE *) mmap(0, sizeof(struct SHM_STATE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(m == MAP_FAILED) {
+      shm_unlink(shm_open_name);
+      return;
    }
-   strcpy(rinex_name, s);
-   rinex_header_written = 0;
-   first_obs = 1;
-   return rinex_file;
+
+   // mark the segment as being updated while the header is filled in
+   __atomic_store_n(&m->seq, m->seq | 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   m->magic = SHM_MAGIC;
+   m->version = SHM_VERSION;
+   m->size = (u32) sizeof(struct SHM_STATE);
+   m->pid = (u32) getpid();
+   m->updates = 0;
+   __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+
+   shm_state = m;
+   publish_shm_state();
+   if(debug_file) fprintf(debug_file, "shared memory state published in %s\n", shm_open_name);
 }
 
-FILE *open_raw_file(char *name, char *mode)
+void stop_shm_state()
+{
+   // remove the /wm shared memory segment
+
+   if(shm_state == 0) return;
+   munmap(shm_state, sizeof(struct SHM_STATE));
+   shm_state = 0;
+   shm_unlink(shm_open_name);
+}
+
+#else   // SHM_PUBLISH
+
+void publish_shm_state() { }
+void start_shm_state() { }
+void stop_shm_state() { }
+
+#endif  // SHM_PUBLISH
+
+int gz_name(char *name)
 {
 char *s;
-FILE *file;
+
+   // returns 1 if the file name says the file is gzip compressed
 
    if(name == 0) return 0;
-   if(mode == 0) return 0;
+   s = strrchr(name, '.');
+   if(s == 0) return 0;
+   if(!strcmp(s, ".gz") || !strcmp(s, ".GZ")) return 1;
+   return 0;
+}
 
-   if(raw_file) {
-      fclose(raw_file);
-      raw_file = 0;
-   }
+#ifdef USE_ZLIB
+#ifdef __linux__
+ssize_t gz_cookie_read(void *cookie, char *buf, size_t len)
+{
+int n;
 
-   s = strchr(name, FLUSH_CHAR);
-   if(s) {
-      *s = 0;
-      raw_flush_mode = 1;
-   }
-   else raw_flush_mode = 0;
+   n = gzread((gzFile) cookie, buf, (unsigned) len);
+   if(n < 0) return (-1);
+   return (ssize_t) n;
+}
 
-//lfs drain_port(RCVR_PORT);
-   wakeup_tsip_msg = 0;        // cause wait for full receiver message before logging raw data
-   saw_rcvr_msg = 0;
-   file = topen(name, mode);
-   if(file) {
-      if(debug_file) fprintf(debug_file, "! raw capture file %s opened\n", name);
-   }
-   wakeup_tsip_msg = 0;        // cause wait for full receiver message before logging raw data
-   saw_rcvr_msg = 0;
+int gz_cookie_seek(void *cookie, off64_t *ofs, int whence)
+{
+z_off_t pos;
 
-   return file;
+   if(whence == SEEK_END) return (-1);  // not known without reading the whole file
+   pos = gzseek((gzFile) cookie, (z_off_t) *ofs, whence);
+   if(pos < 0) return (-1);
+   *ofs = (off64_t) pos;
+   return 0;
+}
+#else  // __MACH__  __FreeBSD__
+int gz_cookie_read(void *cookie, char *buf, int len)
+{
+   return gzread((gzFile) cookie, buf, (unsigned) len);
 }
 
-FILE *open_prn_file(char *name, char *mode)
+fpos_t gz_cookie_seek(void *cookie, fpos_t ofs, int whence)
+{
+   if(whence == SEEK_END) return (fpos_t) (-1);
+   return (fpos_t) gzseek((gzFile) cookie, (z_off_t) ofs, whence);
+}
+#endif
+
+int gz_cookie_close(void *cookie)
+{
+   return (gzclose((gzFile) cookie) == Z_OK) ? 0 : EOF;
+}
+#endif  // USE_ZLIB
+
+FILE *ztopen(char *name, char *mode)
 {
-char *s;
 FILE *file;
+#ifdef USE_ZLIB
+FILE *zfile;
+gzFile gz;
+int fd;
+#ifdef __linux__
+cookie_io_functions_t io;
+#endif
+#endif
 
-   if(name == 0) return 0;
-   if(mode == 0) return 0;
+   // open a file for reading.  Files whose name ends in .gz are returned as
+   // a stdio stream that reads the uncompressed data (they can seek,  but
+   // seeking backwards is slow).
 
-   if(prn_file) {
-      fclose(prn_file);
-      prn_file = 0;
-      prn_count = 0;
-   }
+   file = topen(name, mode);
+   if(file == 0) return 0;
 
-   s = strchr(name, FLUSH_CHAR);
-   if(s) {
-      *s = 0;
-      prn_flush_mode = 1;
+#ifdef USE_ZLIB
+   if(gz_name(name) == 0) return file;
+   if((mode[0] != 'r') || strchr(mode, '+')) return file;
+
+   fd = dup(fileno(file));
+   if(fd < 0) return file;
+   gz = gzdopen(fd, "rb");
+   if(gz == 0) {
+      close(fd);
+      return file;
    }
-   else prn_flush_mode = 0;
+   gzbuffer(gz, 128*1024);
 
-//lfs drain_port(RCVR_PORT);
-   file = topen(name, mode);
-   if(file) {
-      fprintf(file, "#JD UTC         PRN   AZ     EL     SIG\n");
-      fprintf(file, "# 1\n");
-      if(prn_flush_mode) fflush(file);
-      prn_count = 1;
-      if(debug_file) fprintf(debug_file, "! PRN file %s opened\n", name);
+   #ifdef __linux__
+      io.read = gz_cookie_read;
+      io.write = 0;
+      io.seek = gz_cookie_seek;
+      io.close = gz_cookie_close;
+      zfile = fopencookie(gz, "r", io);
+   #else
+      zfile = funopen(gz, gz_cookie_read, 0, gz_cookie_seek, gz_cookie_close);
+   #endif
+   if(zfile == 0) {
+      gzclose(gz);
+      return file;
    }
 
+   fclose(file);
+   return zfile;
+#else
    return file;
+#endif
 }
 
 void sync_file(FILE *file)
@@ -8677,6 +10617,7 @@ void sync_file(FILE *file)
    if(file == 0) return;
 
    fflush(file);
+   if(async_sync(file)) return;  // the log writer thread does the fsync
 
    #ifdef WINDOWS
    #else // __linux__  __MACH__  __FreeBSD__
@@ -8884,6 +10825,198 @@ int sim_kbd_check()
 }
 
 
+u08 sim_chunk[CAP_MAX_CHUNK];    // capture file replay chunk buffer
+u32 sim_chunk_count;
+u32 sim_chunk_pos;
+double sim_chunk_msecs;          // arrival time of the chunk being replayed
+double sim_base_t;               // GetMsecs() when sim_base_m was replayed
+double sim_base_m;
+double sim_jd0;                  // UTC at the start of the session being replayed
+int sim_fix_jd0;                 // flag set if sim_jd0 is the time of the first chunk
+int sim_rebase;                  // flag set to restart the replay clock
+
+int capture_span(char *name, double *jd_first, double *jd_last)
+{
+FILE *file;
+struct CAP_HEADER h;
+struct CAP_INDEX_ENTRY e;
+long size;
+u32 count;
+u32 i;
+
+   // get the times of the first and last seek index points of a capture
+   // file.  Returns 0 if the file is not a closed capture file.
+
+   file = topen(name, "rb");
+   if(file == 0) return 0;
+
+   count = 0;
+   if((fread(&h, sizeof(h), 1, file) == 1) && (memcmp(h.magic, CAP_MAGIC, 8) == 0)) {
+      fseek(file, 0L, SEEK_END);
+      size = ftell(file);
+      if(size > 0) count = find_capture_index(file, (u64) size);
+   }
+
+   for(i=0; i<count; i++) {
+      if(fread(&e, sizeof(e), 1, file) != 1) break;
+      if(i == 0) *jd_first = e.jd;
+      *jd_last = e.jd;
+   }
+   fclose(file);
+
+   return (i > 1);
+}
+
+void open_sim_capture(long seek_addr)
+{
+struct CAP_HEADER h;
+struct CAP_CHUNK chunk;
+struct CAP_INDEX_ENTRY e;
+double jd;
+double target;
+long size;
+long pos;
+u32 count;
+u32 i;
+
+   // Check if the simulation file just opened is an indexed capture file.
+   // For capture files seek_addr is the number of seconds into the capture
+   // to start at,  otherwise it is a byte offset.  If sim_start_jd is set
+   // the replay starts at the last index point before that time.
+
+   sim_capture = 0;
+   sim_chunk_count = sim_chunk_pos = 0;
+   sim_chunk_msecs = 0.0;
+   sim_rebase = 1;
+   if(sim_file == 0) return;
+
+   if((fread(&h, sizeof(h), 1, sim_file) != 1) || memcmp(h.magic, CAP_MAGIC, 8) || (h.endian != CAP_ENDIAN)) {
+      fseek(sim_file, seek_addr, SEEK_SET);
+      return;
+   }
+
+   sim_capture = 1;
+   sim_jd0 = sim_chunk_jd = h.start_jd;
+   sim_fix_jd0 = 0;
+   pos = sizeof(h);
+   target = 0.0;
+   if(seek_addr > 0) target = h.start_jd + ((double) seek_addr) / (24.0*60.0*60.0);
+   if(sim_start_jd > target) target = sim_start_jd;
+
+   if(target > 0.0) {
+
+      size = (-1L);
+      if(fseek(sim_file, 0L, SEEK_END) == 0) size = ftell(sim_file);
+      count = 0;
+      if(size > 0) count = find_capture_index(sim_file, (u64) size);
+
+      if(count) {  // use the seek index
+         for(i=0; i<count; i++) {
+            if(fread(&e, sizeof(e), 1, sim_file) != 1) break;
+            if(e.jd > target) break;
+            pos = (long) e.offset;
+            sim_jd0 = e.jd;
+            sim_fix_jd0 = 1;
+         }
+      }
+      else {  // no index (or compressed file),  walk the chunk headers
+         jd = h.start_jd;
+         fseek(sim_file, pos, SEEK_SET);
+         while(fread(&chunk, sizeof(chunk), 1, sim_file) == 1) {
+            if(chunk.id != CAP_CHUNK_ID) break;
+            if(chunk.port == CAP_SESSION) {
+               if(fread(&jd, sizeof(jd), 1, sim_file) != 1) break;
+               if(jd > target) break;
+            }
+            else {
+               if((chunk.port < CAP_SESSION) && ((jd + chunk.msecs / (24.0*60.0*60.0*1000.0)) > target)) break;
+               if(fseek(sim_file, (long) chunk.count, SEEK_CUR)) break;
+            }
+            pos = ftell(sim_file);
+         }
+         sim_jd0 = jd;
+      }
+   }
+
+   fseek(sim_file, pos, SEEK_SET);
+   if(debug_file) fprintf(debug_file, "! replaying capture file %s from offset %ld\n", sim_name, pos);
+}
+
+int next_sim_chunk()
+{
+struct CAP_CHUNK chunk;
+
+   // read the next receiver data chunk from a capture file
+
+   sim_chunk_count = sim_chunk_pos = 0;
+
+   while(1) {
+      if(fread(&chunk, sizeof(chunk), 1, sim_file) != 1) return 0;
+      if(chunk.id != CAP_CHUNK_ID) return 0;
+
+      if((chunk.port == CAP_SESSION) && (chunk.count == sizeof(double))) {  // time discontinuity
+         if(fread(&sim_jd0, sizeof(double), 1, sim_file) != 1) return 0;
+         sim_fix_jd0 = 0;
+         sim_rebase = 1;
+         continue;
+      }
+      if(chunk.port >= CAP_SESSION) {  // index or trailer
+         if(fseek(sim_file, (long) chunk.count, SEEK_CUR)) return 0;
+         continue;
+      }
+
+      if(chunk.count > CAP_MAX_CHUNK) return 0;  // corrupted file
+      if(chunk.count == 0) continue;
+
+      if(sim_fix_jd0) {  // sim_jd0 is the index time of this chunk
+         sim_jd0 -= chunk.msecs / (24.0*60.0*60.0*1000.0);
+         sim_fix_jd0 = 0;
+      }
+      sim_chunk_jd = sim_jd0 + chunk.msecs / (24.0*60.0*60.0*1000.0);
+      if(sim_end_jd && (sim_chunk_jd >= sim_end_jd)) return 0;  // end of the replay window
+
+      if(fread(&sim_chunk[0], 1, chunk.count, sim_file) != chunk.count) return 0;
+
+      if(chunk.msecs < sim_chunk_msecs) sim_rebase = 1;
+      sim_chunk_msecs = chunk.msecs;
+      sim_chunk_count = chunk.count;
+      return 1;
+   }
+}
+
+int sim_capture_wait()
+{
+double t;
+
+   // returns 1 if the next chunk of a capture file being replayed with its
+   // original timing has not arrived yet.
+
+   if(sim_capture == 0) return 0;
+   if(sim_file == 0) return 0;
+   if(sim_eof) return 0;
+   if(sim_speed <= 0.0) return 0;  // replay as fast as possible
+
+   if(pause_data) {  // restart the replay clock when resumed
+      sim_rebase = 1;
+      return 0;
+   }
+
+   if(sim_chunk_pos >= sim_chunk_count) {
+      if(next_sim_chunk() == 0) return 0;  // let get_sim_char() see the end of file
+   }
+
+   t = GetMsecs();
+   if(sim_rebase) {
+      sim_base_t = t;
+      sim_base_m = sim_chunk_msecs;
+      sim_rebase = 0;
+      return 0;
+   }
+
+   if(t < (sim_base_t + (sim_chunk_msecs - sim_base_m) / sim_speed)) return 1;
+   return 0;
+}
+
 u08 get_sim_char(unsigned port)
 {
 int flag;
@@ -8896,7 +11029,13 @@ u08 c;
       return 0;
    }
 
-   flag = fread(&c, 1, 1, sim_file);
+   if(sim_capture) {  // indexed capture file
+      flag = 1;
+      if(sim_chunk_pos >= sim_chunk_count) flag = next_sim_chunk();
+      if(flag) c = sim_chunk[sim_chunk_pos++];
+   }
+   else flag = fread(&c, 1, 1, sim_file);
+
    if(flag <= 0) {  // just reached the end of file
       BEEP(4);
       sim_eof = 1;
@@ -9152,6 +11291,7 @@ if((port == RCVR_PORT) && (rcvr_type == TIDE_RCVR) && (enable_terminal == 0)) {
 }
 
    if((port == RCVR_PORT) && sim_file) {  // using a simulation file
+      if(sim_capture_wait()) return 0;      // replaying a capture in real time
       return sim_kbd_check();
    }
 
@@ -9724,6 +11864,7 @@ int sync;
 
    kill_com(port, why);   // in case COM port already open
    com[port].com_error = 0;
+   if(batch_mode) return;  // headless /mc worker,  the data comes from the sim file
    if((port == RCVR_PORT) && (rcvr_type == NO_RCVR) && (enable_terminal == 0)) { // alternate ready/not ready each check
       return;
    }
@@ -9888,6 +12029,7 @@ if((port == RCVR_PORT) && (rcvr_type == TIDE_RCVR) && (enable_terminal == 0)) {
 }
 
    if((port == RCVR_PORT) && sim_file) {  // using a simulation file
+      if(sim_capture_wait()) return 0;      // replaying a capture in real time
       return sim_kbd_check();
    }
 
@@ -10119,7 +12261,8 @@ void init_hardware(void)
    init_com(RCVR_PORT, 2);
    init_screen(9103);
 
-   if(NO_SCPI_BREAK && (rcvr_type == SCPI_RCVR)) ; 
+   if(batch_mode) ;  // headless,  no receiver port
+   else if(NO_SCPI_BREAK && (rcvr_type == SCPI_RCVR)) ; 
    else if(nortel == 0) {    // To wake up a Nortel NTGS55A, etc receiver
       SendBreak(RCVR_PORT); 
    }
@@ -10463,6 +12606,7 @@ printf("Physical screen size: %dx%d\n", SCREEN_WIDTH,SCREEN_HEIGHT);
    else small_font = 0;
 
    dot_font = (unsigned char *) (void *) vfx_font;
+   if(batch_mode) return;  // headless /mc worker,  the drawing routines do nothing without a display
 
 
 
@@ -13387,18 +15531,23 @@ unsigned port;
       Sleep(500);
    }
 
+   stop_metrics();       // stop any /ws metrics web server
+   stop_shm_state();     // remove any /wm shared memory state
+   stop_sky_predict();   // stop the /sk sky prediction thread
+
 #ifdef ADEV_STUFF
    log_adevs();          // write adev info to the log file
+   if(adev_ckpt_name[0]) save_adev_checkpoint(adev_ckpt_name);  // save adev state for the next startup
 #endif
 
    log_stats();
 
+   finish_log_dump();    // complete any background queue dump
+   close_rra_file();     // write out the partial trend archive rows
+
    end_log();            // close out the ASCII log file
 
-   if(raw_file) {        // close out raw receiver data dump file
-      fclose(raw_file);
-      raw_file = 0;
-   }
+   close_raw_file();     // close out raw receiver data dump file
 
    if(prn_file) {        // close out sat az/el/sig level data dump file
       fclose(prn_file);
@@ -13409,6 +15558,7 @@ unsigned port;
       fclose(rinex_file);
       rinex_file = 0;
    }
+   merge_rinex_parts();  // collect the output of any /mc worker processes
 
    if(ticc_file) {        // close out TICC data dump file
       fclose(ticc_file);
@@ -13461,6 +15611,7 @@ unsigned port;
    free_gif();
    free_adev_queues();
    free_mtie();
+   free_stream_hist();
    free_plot();
 
    exit(reason);
@@ -13568,6 +15719,7 @@ int j;
 //    q1.data[j] = q2.data[j];  // replace with next point's data
    }
    put_plot_q(i, q1);
+   reset_stream_hist();
 }
 
 void deglitch_queue_point()
@@ -13669,6 +15821,7 @@ if(debug_file) fprintf(debug_file, "deglitch > %s:  #%ld   queue %ld   sdev:%g
       col += plot_mag;    // deglitch displayed points
       if(col >= (PLOT_WIDTH*view_interval)) break;
    }
+   if(dg_count) reset_stream_hist();
 // sprintf(debug_text3, "count:%ld  col:%d", count,col);
 }
 
@@ -13814,6 +15967,7 @@ void free_plot()
 {
    // release the plot queue memory
 
+   finish_log_dump();  // a background dump is still reading the queue
    if(plot_q == 0) return;
    free(plot_q);
    plot_q = 0;
@@ -13880,13 +16034,13 @@ void free_fft()
 #ifdef FFT_STUFF
    if(tsignal) free(tsignal);
    if(fft_out) free(fft_out);
-   if(w) free(w);
-   if(cf) free(cf);
+   free_fft_plans();
+   free_psd();
+   free_sdft();
+   free_xcorr();
 
    tsignal = 0;
    fft_out = 0;
-   w = 0;
-   cf = 0;
 #endif
 }
 
@@ -13898,7 +16052,7 @@ long i;
 
    // allocate memory for the FFT routine 
    free_fft();
-   if(max_fft_len == 0) max_fft_len = 1024;
+   if(max_fft_len == 0) max_fft_len = DEFAULT_FFT_LEN;
 
    if(tsignal == 0) {  
       i = sizeof(float);
@@ -13910,17 +16064,7 @@ long i;
       i *= (max_fft_len/2+2);
       fft_out = (COMPLEX *) (void *) calloc(i, 1);
    }
-   if(w == 0) {  
-      i = sizeof(COMPLEX);
-      i *= (max_fft_len/2+2);
-      w = (COMPLEX *) (void *) calloc(i, 1);
-   }
-   if(cf == 0) {  
-      i = sizeof(COMPLEX);
-      i *= (max_fft_len/2+2);
-      cf = (COMPLEX *) (void *) calloc(i, 1);
-   }
-   if((tsignal == 0) || (fft_out == 0) || (w == 0) || (cf == 0)) {
+   if((tsignal == 0) || (fft_out == 0)) {
       sprintf(out, "Could not allocate FFT tables");
       error_exit(53, out);
    }
@@ -14014,6 +16158,8 @@ int k;
       chd_bins.adev_min = 0.0;
       chd_bins.adev_max = 0.0;
 
+      clear_hat_queues();
+
       for(i=0; i<MAX_ADEV_BINS; i++) {
          pps_bins.adev_on[i] = 0;
          pps_bins.adev_taus[i] = 0.0;
@@ -14128,6 +16274,7 @@ int k;
 #endif
 
    if(queue_type & RESET_PLOT_Q) {  // reset plot queue
+      finish_log_dump();  // write out any background dump of the old data first
       plot_q_in = plot_q_out = 0;
       plot_q_count = 0;
       plot_q_full = 0;
@@ -14150,6 +16297,10 @@ int k;
 
       reset_marks();
       rebuild_lla_plot(0);
+#ifdef FFT_STUFF
+      reset_psd();
+      reset_sdft();
+#endif
       if(dont_reset_queues == 0) {
          ticc_packets = 0;
       }
@@ -15694,6 +17845,18 @@ DATA_SIZE val;
       strcpy(stat_id, "span");
       val = plot[id].max_disp_val - plot[id].min_disp_val;
    }
+   else if(plot[id].show_stat == SHOW_P50) {  // percentiles are of all the queued data
+      strcpy(stat_id, "p50");
+      val = (DATA_SIZE) stream_hist_pct(id, 50.0);
+   }
+   else if(plot[id].show_stat == SHOW_P99) {
+      strcpy(stat_id, "p99");
+      val = (DATA_SIZE) stream_hist_pct(id, 99.0);
+   }
+   else if(plot[id].show_stat == SHOW_P999) {
+      strcpy(stat_id, "p99.9");
+      val = (DATA_SIZE) stream_hist_pct(id, 99.9);
+   }
    else {
       strcpy(stat_id, "???");
       val = (DATA_SIZE) 0.0;
@@ -16822,6 +18985,24 @@ u16 sat_flags;
          }
          else sprintf(out, "%s: DC blocked    ", plot[fft_id].plot_id);
       }
+      else if(fft_type == XCORR_TYPE) {
+         i = last_mouse_q - fft_queue_0;
+         if(i < 0) i += plot_q_size;
+         i /= (S32) fft_scale;
+         val = (double) i * fps;
+         if(i >= (fft_length/2)) sprintf(out, "              ");
+         else if(val) sprintf(out, "COH: %-.3g Hz  %.3f   ", val, xcorr_coherence_at(i));
+         else sprintf(out, "COH: DC blocked    ");
+      }
+      else if(fft_type == PSD_TYPE) {
+         i = last_mouse_q - fft_queue_0;
+         if(i < 0) i += plot_q_size;
+         i /= (S32) fft_scale;
+         val = (double) i * fps;
+         if(i >= (fft_length/2)) sprintf(out, "              ");
+         else if(val) sprintf(out, "%s: %-.3g Hz  %.1f dB   ", plot[fft_id].plot_id, val, psd_db(i));
+         else sprintf(out, "%s: DC blocked    ", plot[fft_id].plot_id);
+      }
       else {  // histogram
          if(mouse_plot_valid && (mouse_x >= 0) && (mouse_x < hist_size)) {
             val = hist_minv + hist_bin_width*(DATA_SIZE) mouse_x;
@@ -18109,6 +20290,7 @@ void draw_plot(u08 refresh_ok)
 {
    // draw everything related to the data plots
    if(first_key) return;   // plot area is in use for help/warning message
+   if(batch_mode) return;  // no screen
 
    if(text_mode || (rcvr_type == NO_RCVR) || no_plots) {   // plot area is not available,  only draw text stuff
       plot_axes();
@@ -18494,6 +20676,13 @@ DATA_SIZE sig;
    }
    plot_time = 0;
 
+   if(reading_log == 0) rra_update(&q);  // add the entry to the trend archive
+
+#ifdef FFT_STUFF
+   if(psd_plot >= 0) add_psd_point(&q);  // keep the Welch PSD average current
+   if(show_live_fft) add_sdft_point(&q);  // slide the live FFT forward
+#endif
+
    if(review_mode == 0) {
       review = plot_q_count;  
    }
@@ -18540,22 +20729,32 @@ DATA_SIZE sig;
    if(view_time >= view_interval) view_time = 0;
 
 
-   // prepare queue for next point
+   advance_plot_q();   // prepare queue for next point
+
+   if(draw_flag) {
+      show_title();    // rrrrr
+      refresh_page();
+   }
+}
+
+void advance_plot_q()
+{
+   // the entry at plot_q_in is complete,  move on to the next queue slot
+
+   if(hbl_streaming) hbl_stream_entry(plot_q_in);  // converting a log to .hbl
+   stream_hist_add(plot_q_in);  // count the new entry in the streaming histograms
    if(++plot_q_count >= plot_q_size) plot_q_count = plot_q_size;
    if(++plot_q_in >= plot_q_size) {
       plot_q_in = 0;  
    }
    if(plot_q_in == plot_q_out) {  // plot queue is full
+      stream_hist_evict(plot_q_out);
       if(++plot_q_out >= plot_q_size) plot_q_out = 0;
       plot_q_count = plot_q_size;
       plot_q_full = 1;
    }
    clear_plot_entry((long) plot_q_in);
-
-   if(draw_flag) {
-      show_title();    // rrrrr
-      refresh_page();
-   }
+   stream_hist_sync();
 }
 
 
@@ -18565,6 +20764,7 @@ void redraw_screen()
    if(first_key) {  // we are showing a keyboard menu show hold off on the redraw
       return; 
    }
+   if(batch_mode) return;  // no screen
 
    need_redraw = 0;
    last_plot_tick = (-1);
@@ -19621,7 +21821,7 @@ void serve_os_queue()
 
    #ifdef USE_X11
       get_x11_event();
-      XFlush(display);
+      if(display) XFlush(display);
    #endif
 }
 
@@ -20316,6 +22516,14 @@ continuous_scroll = 1;
    sim_jd = jdate(clk_year,clk_month,clk_day) + jtime(clk_hours,clk_minutes,clk_seconds,0.0);
 
    queue_interval = 1;     // seconds between queue updates
+   async_logs = 1;         // write log files from a background thread
+   log_fsync_secs = 0;     // ... and fsync them on the hourly log syncs
+#ifdef FFT_STUFF
+   live_fft_len = DEFAULT_LIVE_FFT_LEN;
+   psd_plot = (-1);        // Welch PSD not running
+   psd_seg_len = DEFAULT_PSD_LEN;
+   psd_type = PSD_SY;
+#endif
    log_interval = 1;       // seconds between log file entries
    log_header = 1;         // write timestamp headers to the log file
    view_interval = 1;      // plot window view time
@@ -20444,7 +22652,7 @@ subtract_base_value = 0;
       if(i >= FIRST_EXTRA_PLOT) {
          extra_plots |= plot[i].show_plot;
       }
-      plot_stat_info |= plot[i].show_stat;
+      if(plot[i].show_stat) plot_stat_info = 1;
    }
 
    plot[OSC].units = ppt_string;
@@ -20485,6 +22693,7 @@ subtract_base_value = 0;
    last_lla_span = LLA_SPAN;
 
    adev_q_size = (12L*3600L);      // 12 hours - good for 10000 tau
+   adev_ckpt_secs = ADEV_CKPT_SECS;
    plot_q_size = (60L*60L*24L*3L); // 72 hours of data
    mouse_shown = 1;
    last_plot_mouse_x = (-1);
@@ -21085,9 +23294,32 @@ if(first_key == 0) Sleep(1000);
 void get_log_file()
 {
 int i;
+char *s;
 
    if(read_log[0]) {       // user specified a log file to read in
       first_key = ' ';
+      if(hbl_convert_log) {  // convert the log to a binary .hbl log and exit
+         if(hbl_convert[0] == 0) {
+            strcpy(hbl_convert, read_log);
+            s = strrchr(hbl_convert, '.');
+            if(s && (strchr(s, '/') == 0) && (strchr(s, '\\') == 0)) *s = 0;
+            strcat(hbl_convert, ".hbl");
+         }
+
+         // the entries are written as they are read so logs that are
+         // longer than the plot queue are converted completely
+         if(start_hbl_stream(hbl_convert)) {
+            sprintf(out, "Could not create binary log file: %s", hbl_convert);
+            error_exit(60, out);
+         }
+         i = reload_log(read_log, 1);
+         if(stop_hbl_stream() || i) {
+            sprintf(out, "Could not convert %s to %s", read_log, hbl_convert);
+            error_exit(61, out);
+         }
+         shut_down(0);
+      }
+
       i = reload_log(read_log, 1);
       if(i == 0) {         // log file found
          plot_review(0L);  // enter plot review mode to start plot at first point
@@ -21458,8 +23690,7 @@ double old_cto;
           }
           else if(i == F2_CHAR) {               // toggle log
              if(raw_file) {
-                fclose(raw_file);
-                raw_file = 0;
+                close_raw_file();
                 log_stream &= (~LOG_RAW_STREAM);
              }
              else {
@@ -21668,6 +23899,72 @@ if(show_debug_info) printf("Resizing to %d x %d.\n", SCREEN_WIDTH,SCREEN_HEIGHT)
 #endif  // USE_X11
 }
 
+
+//
+//   Background jobs - long calculations are split into steps that are run
+//   from the main loop when there is no keyboard or receiver work to do.
+//   Each step should take no more than a few milliseconds.  A step
+//   function returns 0 when the job is finished.
+//
+
+struct BG_JOB {
+   int (*step)(void);
+   char *name;
+} bg_jobs[MAX_BG_JOBS];
+int bg_job_count;
+
+int start_bg_job(int (*step)(void), char *name)
+{
+int i;
+
+   // queue a background job (if it is not already queued)
+
+   for(i=0; i<bg_job_count; i++) {
+      if(bg_jobs[i].step == step) return 1;
+   }
+   if(bg_job_count >= MAX_BG_JOBS) {
+      edit_error("Too many background jobs running");
+      return 0;
+   }
+
+   bg_jobs[bg_job_count].step = step;
+   bg_jobs[bg_job_count].name = name;
+   ++bg_job_count;
+   if(debug_file) fprintf(debug_file, "background job started: %s\n", name);
+   return 1;
+}
+
+int bg_job_running(int (*step)(void))
+{
+int i;
+
+   for(i=0; i<bg_job_count; i++) {
+      if(bg_jobs[i].step == step) return 1;
+   }
+   return 0;
+}
+
+void run_bg_jobs()
+{
+double t0;
+int i, j;
+
+   // give the background jobs a time slice
+
+   t0 = GetMsecs();
+   while(bg_job_count) {
+      for(i=0; i<bg_job_count; i++) {
+         if(bg_jobs[i].step() == 0) {  // job finished
+            if(debug_file) fprintf(debug_file, "background job finished: %s\n", bg_jobs[i].name);
+            for(j=i; j<(bg_job_count-1); j++) bg_jobs[j] = bg_jobs[j+1];
+            --bg_job_count;
+            --i;
+         }
+      }
+      if((GetMsecs() - t0) >= BG_SLICE_MSECS) break;
+   }
+}
+
 void do_gps()
 {
 int i;
@@ -21692,6 +23989,9 @@ int i;
       if(!serve_gps(0)) {  // time to exit the progaam
          break;
       }
+      if(rinex_convert[0] && sim_eof) {  // /mc conversion finished
+         break;
+      }
       got_timing_msg = 0;  // used to prevent keyboard lockout if data comming in at high nav rates
 
       if(f11_flag) {  //// !!!! debug
@@ -21720,7 +24020,10 @@ int i;
          i = do_kbd(i);    // process the character
          if(i) break;      // it's time to stop this madness
       }
-      else if(sim_file && (sim_eof == 0)) {  // allow fast simulation file processing... use /sw if throttling or sleep needed
+      else if(sim_file && (sim_eof == 0) && (sim_capture_wait() == 0)) {  // allow fast simulation file processing... use /sw if throttling or sleep needed
+      }
+      else if(bg_job_count) {  // use the idle time for background calculations
+         run_bg_jobs();
       }
       else if(idle_sleep && (set_system_time == 0)) {  // sleep a while when we are not busy to keep cpu usage down
          process_pps(idle_sleep);
@@ -21971,6 +24274,7 @@ int main(int argc, char *argv[])
    #endif
 
    config_program(argc, argv);  // process command line arguments
+   start_rinex_convert();       // /mc - fork any conversion worker processes
 
    if(1) ; 
    else if(((rcvr_type == NO_RCVR) || (rcvr_type == TIDE_RCVR)) && (com[RCVR_PORT].process_com == 0)) {
@@ -22006,6 +24310,12 @@ int main(int argc, char *argv[])
    alloc_memory();    // allocate memory for plot and adev queues, etc
    adjust_view();     // tweak screen for user selected view interval, etc
 
+   #ifdef ADEV_STUFF
+      if(batch_count) {  // /ba - headless batch analysis,  does not return
+         run_batch();
+      }
+   #endif
+
 
    init_hardware();   // initialize the com port, screen, and any other hardware
    hw_setup = 1;
@@ -22056,8 +24366,7 @@ int main(int argc, char *argv[])
 
    if(need_raw_file) {  // open raw receiver log file specified on the command line
       need_raw_file = 0;
-      if(raw_file) fclose(raw_file);
-      raw_file = 0;
+      close_raw_file();
       sprintf(raw_name, "%s.raw", "heather");
       raw_file = open_raw_file(raw_name, "wb");
       if(raw_file) log_stream |= LOG_RAW_STREAM;
@@ -22076,7 +24385,7 @@ int main(int argc, char *argv[])
       if(ticc_file) fclose(ticc_file);
       ticc_file = 0;
       sprintf(ticc_name, "%s.raw", "ticc");
-      ticc_file = topen(ticc_name, "wb");
+      ticc_file = async_topen(ticc_name, "wb");
 // aaattt      if(raw_file) log_stream |= LOG_RAW_STREAM;
    }
 
@@ -22145,6 +24454,11 @@ szAppName[0] = 0;
    show_log_state();    // show logging state
    show_com_state();    // show com port state and flush buffer
    get_log_file();      // read in any initial log file
+   #ifdef ADEV_STUFF
+      if(adev_ckpt_name[0] && (read_log[0] == 0)) {  // restore adev state saved by the last run
+         load_adev_checkpoint(adev_ckpt_name);
+      }
+   #endif
    read_rpn_file(rpn_name, 1);  // read in any calculator user defined functions
 
    if(monitor_mode) {
@@ -22186,6 +24500,10 @@ szAppName[0] = 0;
    }
    #endif
 
+   start_metrics();     // start any /ws metrics web server
+   start_shm_state();   // start any /wm shared memory state
+   start_sky_predict(); // start the /sk sky prediction thread
+
    do_gps();            // run the receiver until something says stop 
 
    exit_pgm:
@@ -22762,9 +25080,14 @@ int fs_help;
 
          "   /a[=#]           - number of points to calc Adevs over (default=432000)\r\n"
          "                      If 0,  then all adev calculations are disabled.\r\n"
+         "   /ac[=file[,secs]]- save/restore ADEV state in checkpoint file (default=heather.adv)\r\n"
+         "   /ad[=chans]      - N-cornered hat ADEVs of TICC channels (i.e. /ad=abc)\r\n"
          "   /ae              - toggles display of error bars in the ADEV plots\r\n"
+         "   /af[=len][,x|y|p]- Welch PSD segment length and units (Sx, Sy, Sphi)\r\n"
+         "   /ag[=mask]       - check MTIE/TDEV against ITU mask (811,812,8272a,8272b)\r\n"
          "   /ah=meters       - set RINEX file antenna height (also e/w and n/s displacements)\r\n"
          "   /ak=marker       - set RINEX file marker name\r\n"
+         "   /am              - toggle MTIE display at power of 2 taus\r\n"
          "   /an=number       - set RINEX file antenna number (can be alphanumeric)\r\n"
          "   /at=antenna      - set RINEX file antenna type\r\n"
          "   /av=antenna      - set RINEX file marker number (can be alphanumeric)\r\n"
@@ -22782,6 +25105,9 @@ int fs_help;
          "   /b=nth,start_day,month,nth,end_day,month,hour - set custom DST rule\r\n"
          "                      day:0=Sun..6=Sat  month:1=Jan..12=Dec\r\n"
          "                      nth>0 = from start of month  nth<0 = from end of month\r\n"
+         "   /ba=file         - batch xDEV/MTIE analysis of log or .tie files (wildcards ok)\r\n"
+         "   /bf=csv|json     - set batch analysis output format (default=csv)\r\n"
+         "   /bj=#            - set number of batch files analyzed at a time\r\n"
          "   /br[=#]          - set serial port configuration. (default 9600:8:n:1)\r\n"
          "   /bs              - set time display to solar time\r\n"
          "   /bt              - start up in terminal emulator mode\r\n"
@@ -22803,6 +25129,7 @@ int fs_help;
          "   /de[=#]          - set debug information level\r\n"
          "   /dl[=file]       - write debug information log file\r\n"
          "   /dr[=file]       - write raw receiver data capture file (default heather.raw)\r\n"
+         "                      (.hrc files are chunked with arrival times and a seek index)\r\n"
          "   /dq[=file]       - write TICC device raw data capture file (default ticc.raw)\r\n"
          "   /e?[=port]       - enable extra com port\r\n"
          "                      ?: D=DAC  E=ECHO  F=FAN  I=TICC  K=NMEA  N=ENVIRONMENTAL sensor\r\n"
@@ -22858,15 +25185,20 @@ int fs_help;
          "   /kv              - toggle touch screen keyboard enable\r\n"
          "   /k?[=#]          - set temp control PID parameter '?'\r\n"
          "   /l[=#]           - write Log file every entry # seconds (default=1)\r\n"
+         "   /la              - toggle writing log files from a background writer thread\r\n"
+         "   /lb[=file]       - convert the /r log file to a binary .hbl log and exit\r\n"
          "   /lc              - don't write any comments in the log file\r\n"
          "   /ld              - write signal level comments in the log file\r\n"
          "   /lo              - enable reading of old format log files\r\n"
          "   /lh              - don't write timestamp headers in the log file\r\n"
          "   /li              - don't wait for receiver id before logging data\r\n"
          "   /ls              - change log file value separator from tab to a comma\r\n"
+         "   /ly=#            - log writer fsync policy: -1=never  0=hourly  #=every # seconds\r\n"
          "   /m[=#]           - Multiply all plot scale factors by # (default is to double)\r\n"
          "   /ma              - toggle Auto scaling\r\n"
          "   /mb              - toggle mapping of all mouse buttons to left-click\r\n"
+         "   /mc=file[,N]     - convert the /rs capture file to a RINEX file and exit\r\n"
+         "                      (.hrc captures are split over N processes)\r\n"
          "   /md[=#]          - set DAC plot scale factor (microvolts/divison)\r\n"
          "   /mi              - invert pps and temperature plots\r\n"
          "   /mo[=#]          - set OSC plot scale factor (parts per trillion/divison)\r\n"
@@ -22906,11 +25238,17 @@ int fs_help;
          "   /pw[=#]          - set time interbal counter phase wrap interval (default=100.0E-9 seconds)\r\n"
          "   /q[=#]           - set size of plot Queue in seconds (default=3 days)\r\n"
          "   /qf[=#]          - set max size of FFT (default=4096)\r\n"
+         "   /ql[=#]          - set size of the live sliding FFT (default=4096)\r\n"
          "   /r[=file]        - Read file (default=tbolt.log)\r\n"
-         "                      .log   .xml  .gpx (log files)\r\n"
+         "                      .log   .xml  .gpx  .hbl (log files)  .rra=trend archive\r\n"
          "                      .scr=script  .lla=lat/lon/altitude\r\n"
          "                      .adv=adev    .tim=ti.exe time file\r\n"
+         "   /ra[=file]       - keep a round robin trend archive (default=heather.rra)\r\n"
          "   /rb              - toggle showing of reason code for beeps\r\n"
+         "   /rp[=speed]      - replay .hrc capture files in real time (default=1, 0=max speed)\r\n"
+         "   /rv=avg|min|max  - which values to read from a .rra trend archive\r\n"
+         "   /rw=start[,end]  - only read the time window start..end from the /r log\r\n"
+         "                      (yyyy-mm-dd[Thh:mm:ss],  default end is one day later)\r\n"
          "   /rm[=types]      - set receiver raw measurment types to write to RINEX files\r\n"
          "                      (C1,P1,P2,L1,L2,D1,D2,S1,S2)\r\n"
          "   /rr[=secs]       - set receiver raw satellite data message output rates (seconds)\r\n"
@@ -22918,6 +25256,7 @@ int fs_help;
          "                      or /ro says 1024 weeks,  /ro=2* says 2048 weeks, etc\r\n"
          "   /ri=file[,seek]  - get input from counter data simulation file\r\n"
          "   /rs=file[,seek]  - get input from raw receiver data simulation file\r\n"
+         "                      (seek is seconds into the capture for .hrc files)\r\n"
          "   /rt[=#]          - use Resolution-T serial port config (9600,8,ODD,1)\r\n"
          "                      [#=1]=force Resolution-T  [#=2]force Resolution SMT\r\n"
          "   /rx#[=leapsecs]  - set receiver type # (A=Acron  B=Brandywine  D=Datum  E=NEC  F=RFTG-m\r\n"
@@ -22937,6 +25276,7 @@ int fs_help;
          "                      count you can specify the value to use (e.g. /rxlp=18)\r\n"
 //       "   /sf              - enter 2D/3D fix mode and map fixes\r\n"
          "   /si[=#]          - set maximum number of displayed satellites to #\r\n"
+         "   /sk[=file]       - toggle predicted sat trails (=file: save sat counts)\r\n"
          "   /so[=#]          - set outline shape to show sat map sats in\r\n"
          "                      (0=round  1=square  2=round with wings  3=rectangular with wings)\r\n"
          "   /sp[=#]          - do Precison Survey (# hours,  default=48/max=96)\r\n"
@@ -23038,8 +25378,10 @@ int fs_help;
          "   /wf=[#]          - set watch face type (0=Roman  1=Arabic  2=Stars\r\n"
          "                      add 3 for 24 hour mode)\r\n"
          "   /wh              - toggle writing log file as an ASCII hex dump file)\r\n"
+         "   /wm[=name]       - publish live state in shared memory (default=/heather)\r\n"
          "   /wp=prefix       - set prefix to use on scheduled log/screen dump file names\r\n"
          "   /wq              - toggles log flush mode for open log files\r\n"
+         "   /ws[=[addr:]port]- serve live metrics over HTTP (default=127.0.0.1:9110)\r\n"
          "   /wt[=#]          - watch fance hand shape (0=straight, 1=filled, 2=hollow)\r\n"
          "   /x=#             - set experimental oscillator disiplining PID value\r\n"
          "   /y               - optimize plot grid for 24 hour display (/y /y = 12hr)\r\n"
@@ -958,7 +958,10 @@ else if(zoom_screen == 'H') ;
       return;  // !!!! dont start logging until a full message has been seen 
    }
 
-   if((log_stream & LOG_RAW_STREAM) && raw_file) {  // recording raw receiver data
+   if((log_stream & LOG_RAW_STREAM) && raw_file && raw_capture) {  // indexed capture file
+      capture_raw_byte(RCVR_PORT, (u08) c);  // flushed a chunk at a time
+   }
+   else if((log_stream & LOG_RAW_STREAM) && raw_file) {  // recording raw receiver data
       fprintf(raw_file, "%c", c);
       if(raw_flush_mode) fflush(raw_file);  // sync raw data stream to disk every byte (for crash analysis)
 //else fflush(raw_file);
@@ -2268,6 +2271,8 @@ void primary_misc()
       update_sat_trails();  // update sat az/el position array
    #endif
 
+   update_sky_predict();    // hand any new orbit data to the sky prediction thread
+
 
    if(set_time_minutely) {  // we do it a xx:xx:06 local time every minute
       if(pri_seconds == SYNC_SECOND) {
@@ -2324,6 +2329,9 @@ void primary_misc()
    greet_on = 1;        // it's now OK to calculate greetings
    get_delta_t();       // try to get delta_t from external file deltat.dat
    check_end_times();   // exit program at preset time
+   #ifdef ADEV_STUFF
+      check_adev_checkpoint();  // periodically save the adev state
+   #endif
 
    silly_clocks();      // do alarm clock and cuckoo clock
    grav_force(jd_utc);  // calculate gravity and earth tides
@@ -10085,22 +10093,40 @@ int i;
 void get_almanac_data()
 {
 int prn;
+int week;
+double e, toa, io, odot, sqrtA, omega_0, omega, M0;
 
    log_packet_id("Packet 0x40 - Almanac data");
 
    prn = tsip_byte();
    tsip_single();   // seconds
-   tsip_word();     // week
-   tsip_single();   // eccentricity
-   tsip_single();   // T_oa
-   tsip_single();   // I_o
-   tsip_single();   // OMEGA_dot
-   tsip_single();   // sqrt(A)
-   tsip_single();   // OMEGAo
-   tsip_single();   // omega
-   tsip_single();   // Mo
+   week = tsip_word();
+   e = tsip_single();
+   toa = tsip_single();
+   io = tsip_single();
+   odot = tsip_single();
+   sqrtA = tsip_single();
+   omega_0 = tsip_single();
+   omega = tsip_single();
+   M0 = tsip_single();
    check_tsip_end(1);
    if(tsip_error) return;
+
+   if(prn < 1) return;
+   if(prn > 32) return;
+   if(sqrtA == 0.0) return;  // no almanac for the sat
+
+   // save the almanac for the sky visibility prediction
+   sat[prn].alm_week = week;
+   sat[prn].alm_e = e;
+   sat[prn].alm_toa = toa;
+   sat[prn].alm_io = io;
+   sat[prn].alm_omega_dot = odot;
+   sat[prn].alm_sqrtA = sqrtA;
+   sat[prn].alm_omega_0 = omega_0;
+   sat[prn].alm_omega = omega;
+   sat[prn].alm_M0 = M0;
+   sat[prn].alm_valid = 1;
 }
 
 void get_gps_time()
@@ -10771,6 +10797,10 @@ check_eph_val(28, prn);
    sat[prn].odot_n = tsip_double();
 check_eph_val(29, prn);
 
+#ifdef BATCH_ORBITS
+   orbits.valid = 0;  // recalculate the sat orbits with the new ephemeris
+#endif
+
    sat[prn].eph_valid = 1;
    if(tsip_error) sat[prn].eph_valid = 0;
    if(sat[prn].t_ephem < 0.0) sat[prn].eph_valid = 0;
@@ -10782,6 +10812,152 @@ if(0 && log_file) fprintf(log_file, "#t_ephem: %f\n", sat[prn].t_ephem);
 }
 
 
+#ifdef BATCH_ORBITS
+void calc_sat_orbits(double t)
+{
+int prn;
+int gnss;
+int j, k;
+int n;
+int done;
+double tk;
+double tc;
+double Ek;
+double nu;
+double Phi;
+double s2, c2;
+double du,dr,di;
+double u;
+double r;
+double i;
+double x_prime;
+double y_prime;
+double omega;
+
+   // Calculate the positions and predicted ranges of all sats with valid
+   // ephemeris for time-of-week t in one pass.  The
+   // work is laid out as structure-of-arrays loops over the batch so that
+   // each receiver raw data message for the epoch just looks up its result.
+   // GLONASS broadcasts state vectors instead of Keplerian elements and is
+   // not handled here.  BeiDou GEO sats (C01-C05, C59-C63) need a different
+   // earth rotation than the MEO/IGSO sats and are also skipped.
+
+   n = 0;
+   for(prn=1; prn<=MAX_PRN; prn++) {
+      if(n >= ORBIT_SATS) break;
+      if(sat[prn].eph_flag == 0) continue;
+      if(sat[prn].eph_valid == 0) continue;
+      if(sat[prn].sqrtA == 0.0) continue;
+
+      gnss = rinex_gnss(prn);
+      if(gnss & GLONASS) continue;
+      if(gnss & BEIDOU) {
+         j = beidou_prn(prn);
+         if((j <= 5) || (j >= 59)) continue;  // GEO sat
+      }
+
+      tk = t;
+      if(gnss & (GALILEO | BEIDOU)) orbits.mu[n] = 3.986004418e14;
+      else                          orbits.mu[n] = 3.986005e14;
+      if(gnss & BEIDOU) {
+         orbits.wie[n] = 7.292115e-5;
+         tk -= 14.0;   // BeiDou time is 14 seconds behind GPS time
+      }
+      else orbits.wie[n] = 7.2921151467e-5;
+
+      // sat clock polynomial
+      tc = tk - sat[prn].toc;
+      if(tc > 302400.0)  tc = tc - 604800.0;
+      if(tc < -302400.0) tc = tc + 604800.0;
+      orbits.clk[n] = sat[prn].af0 + (sat[prn].af1 + sat[prn].af2*tc)*tc - sat[prn].tGD;
+
+      tk -= sat[prn].eph_toe;
+
+      // account for beginning of end of week crossover
+      if(tk > 302400.0)  tk = tk - 604800.0;
+      if(tk < -302400.0) tk = tk + 604800.0;
+
+      orbits.prn[n] = prn;
+      orbits.tk[n] = tk;
+      orbits.e[n] = sat[prn].e;
+      orbits.A[n] = sat[prn].sqrtA * sat[prn].sqrtA;
+      orbit_slot[prn] = n;
+      ++n;
+   }
+   orbits.count = n;
+
+   // mean anomaly with the mean motion correction applied (ICD table 20-IV)
+   for(k=0; k<n; k++) {
+      prn = orbits.prn[k];
+      orbits.mk[k] = sat[prn].M0 + (sqrt(orbits.mu[k]/(orbits.A[k]*orbits.A[k]*orbits.A[k])) + sat[prn].delta_n)*orbits.tk[k];
+      orbits.E[k] = orbits.mk[k];
+   }
+
+   // solve Kepler's equation for all sats in lockstep
+   for(j=0; j<30; j++) {
+      done = 1;
+      for(k=0; k<n; k++) {
+         Ek = orbits.E[k];
+         orbits.E[k] -= (Ek - orbits.e[k]*sin(Ek) - orbits.mk[k]) / (1.0-orbits.e[k]*cos(Ek));
+         if(fabs(orbits.E[k] - Ek) >= 1.0E-14) done = 0;
+      }
+      if(done) break;
+   }
+
+   for(k=0; k<n; k++) {
+      prn = orbits.prn[k];
+      Ek = orbits.E[k];
+      tk = orbits.tk[k];
+
+      // relativistic sat clock correction
+      orbits.clk[k] += -4.442807633e-10 * orbits.e[k] * sat[prn].sqrtA * sin(Ek);
+
+      // true anomaly
+      nu = atan2( (sqrt(1.0-(orbits.e[k]*orbits.e[k]))*sin(Ek)/(1.0-orbits.e[k]*cos(Ek))), 
+                  ((cos(Ek)-orbits.e[k])/(1.0-orbits.e[k]*cos(Ek))) );
+
+      // harmonic corrections
+      Phi = nu + sat[prn].omega;
+      s2 = sin(2.0*Phi);
+      c2 = cos(2.0*Phi);
+      du = sat[prn].Cus*s2 + sat[prn].Cuc*c2;
+      dr = sat[prn].Crs*s2 + sat[prn].Crc*c2;
+      di = sat[prn].Cis*s2 + sat[prn].Cic*c2;
+
+      u = Phi + du;
+      r = orbits.A[k]*(1.0-orbits.e[k]*cos(Ek)) + dr;
+
+      // inclination angle at reference time
+      i = sat[prn].io + sat[prn].i_dot*tk + di;
+      x_prime = r*cos(u);
+      y_prime = r*sin(u);
+      omega = sat[prn].omega_0 + (sat[prn].omega_dot - orbits.wie[k])*tk - orbits.wie[k]*sat[prn].toe;
+
+      orbits.x[k] = x_prime*cos(omega) - y_prime*cos(i)*sin(omega);
+      orbits.y[k] = x_prime*sin(omega) + y_prime*cos(i)*cos(omega);
+      orbits.z[k] = y_prime*sin(i);
+   }
+
+   // predicted ranges from the receiver position
+   lla_to_ecef(lat,lon,alt);
+   orbits.rx_x = ecef_x;
+   orbits.rx_y = ecef_y;
+   orbits.rx_z = ecef_z;
+   for(k=0; k<n; k++) {
+      du = (ecef_x - orbits.x[k]);
+      dr = (ecef_y - orbits.y[k]);
+      di = (ecef_z - orbits.z[k]);
+      orbits.range[k] = sqrt(du*du + dr*dr + di*di);
+      orbits.range[k] -= LIGHTSPEED*1000.0 * orbits.clk[k];  // sat clock leads the range
+      if(orbits.range[k] != orbits.range[k]) orbits.range[k] = 0.0;  // kludgy NAN check
+   }
+
+   orbits.epoch = t;
+   orbits.valid = 1;
+}
+#endif
+
+
 #define CP_WRAP 0    // don't do code phase wrap mode (Acutime GG)
 // #define CP_WRAP 1    // do do code phase wrap mode (Thunderbolt)
 
@@ -10822,7 +10998,11 @@ static double last_pr = 0.0;
 if(0 && log_file) fprintf(log_file, "# prn:%d  eph_flag:%d  eph_valid:%d\n", prn, sat[prn].eph_flag,sat[prn].eph_valid); // rnx3
 
    if(prn < 1) return;
+#ifdef BATCH_ORBITS
+   if(prn > MAX_PRN) return;
+#else
    if(prn > 32) return;
+#endif
 
    pr = 0.0;
    if(sat[prn].eph_flag == 0) {
@@ -10834,6 +11014,27 @@ if(0 && log_file) fprintf(log_file, "# prn:%d  eph_flag:%d  eph_valid:%d\n", prn
       goto no_range;
    }
 
+#ifdef BATCH_ORBITS
+   // the first raw data message of an epoch computes the orbits of all the
+   // sats, the rest of the messages for the epoch use the cached results
+   if((orbits.valid == 0) || (fabs(orbits.epoch - sat[prn].raw_time) > ORBIT_EPOCH_TOL)) {
+      calc_sat_orbits(sat[prn].raw_time);
+   }
+   j = orbit_slot[prn];
+   if((j < 0) || (j >= orbits.count) || (orbits.prn[j] != prn)) goto no_range;
+   if(orbits.range[j] == 0.0) goto no_range;
+
+   sat_x = orbits.x[j];
+   sat_y = orbits.y[j];
+   sat_z = orbits.z[j];
+   ecef_x = orbits.rx_x;
+   ecef_y = orbits.rx_y;
+   ecef_z = orbits.rx_z;
+   du = (ecef_x - sat_x);
+   dr = (ecef_y - sat_y);
+   di = (ecef_z - sat_z);
+   pr = orbits.range[j];
+#else
    compute_harmonic_correction = 1;
 
    mu = 3.986005e14;
@@ -10901,6 +11102,7 @@ if(0 && log_file) fprintf(log_file, "# prn:%d  eph_flag:%d  eph_valid:%d\n", prn
    dr = (ecef_y - sat_y);
    di = (ecef_z - sat_z);
    pr = sqrt(du*du + dr*dr + di*di);
+#endif
 
    iii = (-1);
    if(1) { // piss - adjust raw pseudorange for code_phase
@@ -41520,6 +41722,15 @@ unsigned i, j;
 }
 
 
+static double ticc_sample_time(double v)
+{
+   // time stamp (seconds) of a TICC reading, used to pair up the channels
+   // of the N-cornered hat
+
+   if((ticc_mode == 'T') || (ticc_mode == 'D') || (ticc_mode == 'L')) return v;  // reading is a time stamp
+   return GetMsecs() / 1000.0;  // interval readings of an epoch arrive together
+}
+
 double ticc_phase(char *id, int ticc_mode, double val, double last_val)
 {
    // convert TICC/counter readings to phase values
@@ -41833,6 +42044,7 @@ ticc_field, cha_time2_sum, cha_time2_count, cha_time2_sum/cha_time2_count);
       last_ticc_v1 = v;
       last_cha_ts = v;
 ////if(debug_file) fprintf(debug_file, "cha_offset: %.12f\n", cha_offset);
+      adev_sample_time = ticc_sample_time(v);
       add_pps_adev_point(cha_offset, 0);
 
 if(ticc_type == LARS_TICC) {  // convert DAC setting to frequency offset
@@ -41892,6 +42104,7 @@ ticc_field, chb_time2_sum, chb_time2_count, chb_time2_sum/chb_time2_count);
 
       last_ticc_v2 = v;
       last_chb_ts = v;
+      adev_sample_time = ticc_sample_time(v);
       add_osc_adev_point(chb_offset, 0);
    }
    else if(!strncmp(ticc_field, "CHC", 3)) {
@@ -41925,6 +42138,7 @@ ticc_field, chb_time2_sum, chb_time2_count, chb_time2_sum/chb_time2_count);
       if(last_ticc_v3) have_chc_offset = 55;
       last_ticc_v3 = v;
       last_chc_ts = v;
+      adev_sample_time = ticc_sample_time(v);
       add_chc_adev_point(chc_offset, 0);
    }
    else if(!strncmp(ticc_field, "CHD", 3)) {
@@ -41959,6 +42173,7 @@ ticc_field, chb_time2_sum, chb_time2_count, chb_time2_sum/chb_time2_count);
       if(last_ticc_v4) have_chd_offset = 55;
       last_ticc_v4 = v;
       last_chd_ts = v;
+      adev_sample_time = ticc_sample_time(v);
       add_chd_adev_point(chd_offset, 0);
    }
    else if(!strncmp(ticc_field, "TI(A->B)", 8)) {  // TICC in time interval mode
@@ -49223,6 +49438,11 @@ void show_param_values(int all)
 void update_plot_data()
 {
    // add the latest data to the plot queue and update the screen
+   publish_metrics();  // update the /ws metrics snapshot
+   publish_shm_state();  // update the /wm shared memory state
+   check_async_errors();  // report any log file write errors
+   capture_flush_tick();  // write out the last capture chunk in flush mode
+
    if(have_time && (pause_data == 0)) {
       if(continuous_scroll) update_plot(REFRESH_SCREEN);
       else if((all_adevs == SINGLE_ADEVS) || mixed_adevs) update_plot(REFRESH_SCREEN);
@@ -168,6 +168,7 @@ void set_steps(void);
 #define PALETTE_CMD         0x0160   // edit color palette
 #define DEGLITCH_CMD        0x0161   // set plot deglitch sigma value
 #define DEGLITCH_ALL_CMD    0x0162   // set plot deglitch sigma value
+#define XCORR_CMD           0x0163   // cross-correlate two plots
 
 #define ADEV_BIN_CMD        0x0170   // adev bin sequence
 #define ADEV_HIDE_CMD       0x0171   // hide adev plots
@@ -5194,6 +5195,11 @@ int row,col,width;
       BEEP(6566);
    }
 
+   if(batch_mode) {  // no screen or keyboard
+      printf("*** %s\n", s);
+      return 0;
+   }
+
    refresh_page();
 
    //!!! just waiting for a key here would be bad news because
@@ -8647,6 +8653,22 @@ char *f;
       deglitch_plot_queue(-1, (DATA_SIZE) dval);
       need_redraw =2898;
    }
+#ifdef FFT_STUFF
+   else if(getting_string == XCORR_CMD) {
+      for(i=0; i<NUM_PLOTS+DERIVED_PLOTS; i++) {
+         if(i == FFT) continue;
+         if(plot[i].plot_id && (stricmp(edit_buffer, plot[i].plot_id) == 0)) break;
+      }
+      if(edit_buffer[0] == 0) ;
+      else if(i >= NUM_PLOTS+DERIVED_PLOTS) {
+         sprintf(out, "Unknown plot name: %s", edit_buffer);
+         edit_error(out);
+      }
+      else if(start_xcorr(selected_plot, i) == 0) {
+         edit_error("Could not start the cross-correlation");
+      }
+   }
+#endif
    else if(getting_string == DRVR_CMD) {
       strcpy(mode_string, edit_buffer);
       set_driver_mode();
@@ -9181,8 +9203,7 @@ char *f;
       if(raw_file) {
          strupr(edit_buffer);
          if(strchr(edit_buffer, 'Y')) {
-            fclose(raw_file);
-            raw_file = 0;
+            close_raw_file();
             erase_screen();
             vidstr(0,0, YELLOW, "Closing receiver data capture file.");
             refresh_page();
@@ -9263,7 +9284,7 @@ char *f;
       }
       else {
          strcpy(ticc_name, edit_buffer);
-         ticc_file = topen(ticc_name, "wb");
+         ticc_file = async_topen(ticc_name, "wb");
          if(ticc_file == 0) edit_error("Could not open TICC data log file.");
 // aaattt         else log_stream |= LOG_RAW_STREAM;
       }
@@ -10515,6 +10536,9 @@ blink_prn = BLINK_PLOT;  // blink the plotted prn
             else if(c == 'n') plot[i].show_stat = SHOW_MIN;
             else if(c == 'x') plot[i].show_stat = SHOW_MAX;
             else if(c == 'p') plot[i].show_stat = SHOW_SPAN;
+            else if(c == 'm') plot[i].show_stat = SHOW_P50;
+            else if(c == '9') plot[i].show_stat = SHOW_P99;
+            else if(c == '3') plot[i].show_stat = SHOW_P999;
             else if(c == '?') {
                show_all_stats ^= 1;
                erase_debug_info();
@@ -10532,6 +10556,9 @@ blink_prn = BLINK_PLOT;  // blink the plotted prn
          else if(c == 'n') plot[selected_plot].show_stat = SHOW_MIN;
          else if(c == 'x') plot[selected_plot].show_stat = SHOW_MAX;
          else if(c == 'p') plot[selected_plot].show_stat = SHOW_SPAN;
+         else if(c == 'm') plot[selected_plot].show_stat = SHOW_P50;
+         else if(c == '9') plot[selected_plot].show_stat = SHOW_P99;
+         else if(c == '3') plot[selected_plot].show_stat = SHOW_P999;
          else if(c == '?') {
             show_all_stats ^= 1;
             erase_debug_info();
@@ -10541,7 +10568,7 @@ blink_prn = BLINK_PLOT;  // blink the plotted prn
       }
       plot_stat_info = 0;
       for(c=0; c<NUM_PLOTS+DERIVED_PLOTS; c++) {
-         plot_stat_info |= plot[c].show_stat;
+         if(plot[c].show_stat) plot_stat_info = 1;  // (the SHOW_ bits don't fit in a u08)
       }
    }
    else if(getting_string == OPTION_CMD) {  // enter option/debug value
@@ -11297,6 +11324,23 @@ rebuild_lla_plot(0);  // ckckckck
        calc_fft(selected_plot);
        dump_hist_plot();
     }
+#ifdef FFT_STUFF
+    else if(c == 'k') {  // cross-correlate with another plot
+       getting_plot = 0;
+       if(selected_plot == FFT) return 1;
+       edit_buffer[0] = 0;
+       sprintf(out, "Enter name of plot to cross-correlate %s with (ESC ESC to abort):", plot[selected_plot].plot_id);
+       start_edit(XCORR_CMD, out);
+       return 1;
+    }
+    else if(c == 'w') {  // Welch PSD
+       fft_type = PSD_TYPE;
+       if(selected_plot != FFT) {
+          plot[FFT].show_plot = 1;
+          calc_fft(selected_plot);
+       }
+    }
+#endif
     else if(c == 'i') {  // invert plot
        plot[selected_plot].invert_plot *= (-1.0F);
     }
@@ -11317,7 +11361,7 @@ rebuild_lla_plot(0);  // ckckckck
        getting_plot = 0;
        all_plots = 0;
        edit_buffer[0] = 0;
-       edit_info1 =         "                             miN)   maX)   sP)an      ?)all";
+       edit_info1 =         "                             miN)   maX)   sP)an   M)edian  9)=p99  3)=p99.9   ?)all";
        start_edit(STAT_CMD, "Select statistic to display: A)vg   R)ms   S)td dev   V)ar   <cr>=hide");
        return 1;
     }
@@ -12812,8 +12856,13 @@ redraw_screen();  // gggggg
       else if(first_key == 'w') {  // WF command - write filtered data to log
          filter_log = toggle_value(filter_log);
       }
-      else if(0 && (first_key == 'z')) {  // ZF command - zoom FFT watefall
-         // sorry, disabled because this does nothing useful
+      else if(first_key == 'z') {  // ZF command - zoom live FFT watefall
+#ifdef FFT_STUFF
+         if(selected_plot != FFT) live_fft = selected_plot;
+         fft_type = FFT_TYPE;
+         show_live_fft = 1;
+         if(plot[FFT].show_plot == 0) toggle_plot(FFT);
+#endif
          change_zoom_config(33);
          un_zoom = 0;
          zoom_screen = 'F';
@@ -14338,7 +14387,7 @@ char p;
             start_edit(READ_CMD, "Enter name of .LOG .CAL .CFG .WAV .RAW or .SCRipt file to read (ESC to abort):");
          }
          else {
-            edit_info1 = "The file type is determined by the file name extension.";
+            edit_info1 = "The file type is determined by the file name extension.  (name.log@yyyy-mm-dd reads one day)";
             edit_info2 = "Valid extensions: .LOG .XML .GPX .ADV .LLA .PRN .SIG";
             edit_info3 = "                  .CAL .CFG .WAV .TIM .RAW .RPN or .SCRipt";
             start_edit(READ_CMD, "Enter name of file to read (ESC to abort):");
@@ -15730,7 +15779,7 @@ if(first_key && (osc_params == 0)) { // xxxxxx
          all_plots = 1;
          edit_buffer[0] = 0;
          edit_info1 =         "  A)vg   R)ms   S)td dev   V)ar";
-         edit_info2 =         "  mi)N   ma)X   sP)an";
+         edit_info2 =         "  mi)N   ma)X   sP)an   M)edian  9)=p99  3)=p99.9";
          start_edit(STAT_CMD, "Select plot header statistic to display for all plots (<cr>=hide):");
          return 0;
       }
@@ -19784,9 +19833,64 @@ long seek_addr;
    if(e) f = tolower(arg[4]);
 
 #ifdef ADEV_STUFF
-   if((c == 'a') && (d == 'e')) {  // /ae - toggle adev error bars
+   if((c == 'a') && (d == 'c')) {  // /ac - set adev checkpoint file name and interval
+      if(((e == '=') || (e == ':')) && arg[4]) {
+         strncpy(adev_ckpt_name, &arg[4], sizeof(adev_ckpt_name)-1);
+         adev_ckpt_name[sizeof(adev_ckpt_name)-1] = 0;
+         s = strchr(adev_ckpt_name, ',');
+         if(s) {  // checkpoint interval in seconds given
+            *s = 0;
+            adev_ckpt_secs = atof(s+1);
+         }
+      }
+      else if(adev_ckpt_name[0] && keyboard_cmd) adev_ckpt_name[0] = 0;
+      else strcpy(adev_ckpt_name, "heather.adv");
+      adev_ckpt_msecs = 0.0;
+   }
+   else if((c == 'a') && (d == 'd')) {  // /ad - N-cornered hat across TICC channels
+      if(((e == '=') || (e == ':')) && arg[4]) {
+         hat_chans = 0;
+         for(j=4; arg[j]; j++) {
+            c = tolower(arg[j]);
+            if((c >= 'a') && (c <= 'd')) hat_chans |= (1 << (c - 'a'));
+            else return c;
+         }
+      }
+      else if(hat_chans && keyboard_cmd) hat_chans = 0;
+      else hat_chans = 0x0F;
+      clear_hat_queues();
+   }
+   else if((c == 'a') && (d == 'e')) {  // /ae - toggle adev error bars
       show_error_bars = toggle_option(show_error_bars, e);
    }
+#ifdef FFT_STUFF
+   else if((c == 'a') && (d == 'f')) {  // /af - Welch PSD segment length and units
+      if(((e == '=') || (e == ':')) && arg[4]) {
+         s = &arg[4];
+         if(isdigit(*s)) psd_seg_len = atol(s);
+         s = strchr(s, ',');
+         if(s == 0) s = &arg[4];
+         else ++s;
+         c = tolower(*s);
+         if     (c == 'x') psd_type = PSD_SX;
+         else if(c == 'y') psd_type = PSD_SY;
+         else if(c == 'p') psd_type = PSD_SPHI;
+         else if(isdigit(c)) ;
+         else return c;
+      }
+      else psd_seg_len = DEFAULT_PSD_LEN;
+      if(psd_seg_len < 8) psd_seg_len = 8;
+
+      if(plot[FFT].show_plot && (fft_type == PSD_TYPE)) calc_fft(fft_id);
+   }
+#endif
+   else if((c == 'a') && (d == 'g')) {  // /ag - select ITU MTIE/TDEV mask to check
+      if(((e == '=') || (e == ':')) && arg[4]) {
+         if(set_itu_mask(&arg[4]) == 0) return c;
+      }
+      else if(itu_mask && keyboard_cmd) set_itu_mask("none");
+      else set_itu_mask("8272a");
+   }
    else if((c == 'a') && (d == 'h')) {  // /ah - set antenna height/ew/ns displacement in meters (for RINEX output)
       if(((e == '=') || (e == ':')) && arg[4]) {
          sscanf(&arg[4], "%lf%c%lf%c%lf", &antenna_height,&c,&antenna_ew,&c,&antenna_ns);
@@ -19800,6 +19904,10 @@ long seek_addr;
    else if((c == 'a') && (d == 'j')) {  // /aj - calculate PPS adevs from message jitter
       jitter_adev = toggle_option(jitter_adev, e);
    }
+   else if((c == 'a') && (d == 'm')) {  // /am - toggle MTIE at power of 2 taus
+      mtie_pow2 = toggle_option(mtie_pow2, e);
+      force_adev_redraw(13);
+   }
    else if((c == 'a') && (d == 'n')) {  // /an - set antenna number (for RINEX output)
       if(((e == '=') || (e == ':')) && arg[4]) {
          strcpy(out, &arg[4]);
@@ -19986,6 +20094,24 @@ long seek_addr;
             label_watch_face = 1;
          }
       }
+#ifdef ADEV_STUFF
+      else if(d == 'a') { // /ba=file - analyze the file in headless batch mode
+         if(((e == '=') || (e == ':')) && arg[4]) add_batch_file(&arg[4]);
+         else return c;
+      }
+#endif
+      else if(d == 'f') { // /bf=csv|json - batch mode output format
+         if(((e == '=') || (e == ':')) && arg[4]) {
+            strcpy(out, &arg[4]);
+            strlwr(out);
+            batch_json = (strstr(out, "json") != 0);
+         }
+         else batch_json = 0;
+      }
+      else if(d == 'j') { // /bj=# - number of batch mode processes
+         if(((e == '=') || (e == ':')) && arg[4]) batch_jobs = atoi(&arg[4]);
+         else batch_jobs = 0;
+      }
       else if(d == 't') { // /bt - toggle terminal mode
          if((e == '=') || (e == ':')) {
             enable_terminal = 1;
@@ -20198,21 +20324,12 @@ long seek_addr;
          return 0;
       }
       else if(d == 'r') {  // /dr - open receiver data capture file 
-         if(raw_file) {
-            fclose(raw_file);
-            raw_file = 0;
-         }
+         close_raw_file();
 
          if((e == '=') || (e == ':')) { 
             if(arg[4]) {
                strcpy(raw_name, &arg[4]);
-               s = strchr(raw_name, FLUSH_CHAR);
-               if(s) {
-                  *s = 0;
-                  raw_flush_mode = 1;
-               }
-               else raw_flush_mode = 0;
-               raw_file = fopen(raw_name, "wb");
+               raw_file = open_raw_file(raw_name, "wb");  // strips the flush flag char
             }
          }
          if(raw_file == 0) need_raw_file = 1;
@@ -20843,6 +20960,17 @@ user_set_full_screen = 1;  // piss
       else if(d == 'd') {  // /ld - toggle constellation/signal level data flag
          log_db = toggle_option(log_db, e);
       }
+      else if(d == 'a') {  // /la - toggle the async log writer thread
+         async_logs = toggle_option(async_logs, e);
+      }
+      else if(d == 'b') {  // /lb[=file] - convert the /r log file to a binary .hbl log and exit
+         hbl_convert_log = 1;
+         hbl_convert[0] = 0;
+         if(((e == '=') || (e == ':')) && arg[4]) {
+            strncpy(hbl_convert, &arg[4], sizeof(hbl_convert)-1);
+            hbl_convert[sizeof(hbl_convert)-1] = 0;
+         }
+      }
       else if(luxor && (d == 'f')) {  // /lf - show lux in footcandles
          if(((e == '=') || (e == ':')) && arg[4]) lux_scale = (DATA_SIZE) atof(&arg[4]); 
          else lux_scale = (DATA_SIZE) (1.0 / 10.76391);
@@ -20896,6 +21024,10 @@ user_set_full_screen = 1;  // piss
          config_luxor_plots();
          return 0;
       }
+      else if(d == 'y') {  // /ly=# - log writer fsync policy
+         if(((e == '=') || (e == ':')) && arg[4]) log_fsync_secs = atoi(&arg[4]);
+         else log_fsync_secs = 0;
+      }
       else if(d == 't') {  // /lx - toggle hex packet stream log
          if(log_stream) log_stream = 0;
          else log_stream = (LOG_HEX_STREAM | LOG_PACKET_ID | LOG_PACKET_START | LOG_SENT_DATA);
@@ -20969,6 +21101,20 @@ user_set_full_screen = 1;  // piss
          }
          plot[TEMP].scale_factor = scale_factor;
       }
+      else if(d == 'c') {  //  /mc=file[,workers] - convert the /rs capture file to RINEX and exit
+         if(((e == '=') || (e == ':')) && arg[4]) {
+            strncpy(rinex_convert, &arg[4], sizeof(rinex_convert)-1);
+            rinex_convert[sizeof(rinex_convert)-1] = 0;
+            rinex_workers = 0;
+            s = strchr(rinex_convert, ',');
+            if(s) {
+               *s = 0;
+               rinex_workers = atoi(s+1);
+            }
+         }
+         else return 1;
+         return 0;
+      }
       else if(d == 'w') {  //  /mw - open RINEX file or set RINEX file name
          if(rinex_file) {
             fclose(rinex_file);
@@ -21243,10 +21389,17 @@ long seek_addr;
          else if(e)        max_fft_len = (long) atof(&arg[3]);
          else              max_fft_len = 4096;
          if(max_fft_len < 0) max_fft_len = 0 - max_fft_len;
-         max_fft_len = (1 << logg2(max_fft_len));
          if(keyboard_cmd) {  // we are resizing the FFT queue
             alloc_fft();
          }
+#endif
+      }
+      else if(d == 'l')  {  // /ql - set live (sliding DFT) fft size
+#ifdef FFT_STUFF
+         if(((e == '=') || (e == ':')) && arg[4]) live_fft_len = (long) atof(&arg[4]);
+         else live_fft_len = DEFAULT_LIVE_FFT_LEN;
+         if(live_fft_len < 0) live_fft_len = 0 - live_fft_len;
+         if(live_fft_len < 2) live_fft_len = 2;
 #endif
       }
       else {  // /q - set plot queue size
@@ -21273,7 +21426,27 @@ long seek_addr;
       }
    }
    else if(c == 'r') {    // Read a log file into the plot and adev queues
-      if(d == 'b') {
+      if(d == 'a') {  // /ra[=file] - keep a round robin trend archive file
+         if(((e == '=') || (e == ':')) && arg[4]) strcpy(rra_name, &arg[4]);
+         else strcpy(rra_name, "heather.rra");
+         if(!strstr(rra_name, ".")) strcat(rra_name, ".rra");
+      }
+      else if(d == 'v') {  // /rv=avg|min|max - which trend archive values to read
+         if(((e == '=') || (e == ':')) && arg[4]) {
+            strcpy(out, &arg[4]);
+            strlwr(out);
+            if(strstr(out, "min"))      rra_show = RRA_MIN;
+            else if(strstr(out, "max")) rra_show = RRA_MAX;
+            else                        rra_show = RRA_AVG;
+         }
+         else rra_show = RRA_AVG;
+      }
+      else if(d == 'p') {  // /rp[=speed] - replay .hrc capture files with their recorded timing
+         if(((e == '=') || (e == ':')) && arg[4]) sim_speed = atof(&arg[4]);
+         else sim_speed = 1.0;
+         if(sim_speed < 0.0) sim_speed = 0.0;
+      }
+      else if(d == 'b') {
          show_beep_reason =  toggle_option(show_beep_reason, e);  // /rb - show beep reason
       }
       else if(d == 'i') { // /ri - read aux TICC simulation (raw TICC data) file
@@ -21287,7 +21460,7 @@ long seek_addr;
             }
             else seek_addr = 0;
 
-            ticc_sim_file = topen(ticc_sim_name, "rb");
+            ticc_sim_file = ztopen(ticc_sim_name, "rb");
             if(ticc_sim_file == 0) return 1;
             ticc_sim_file_read |= 0x01;
             ticc_sim_eof = 0;
@@ -21297,6 +21470,13 @@ long seek_addr;
          }
          else return 1;
       }
+      else if(d == 'w') {  // /rw=start[,end] - only read this time window from the /r log
+         if(((e == '=') || (e == ':')) && arg[4]) {
+            strcpy(out, &arg[4]);
+            if(set_log_window(out)) return c;
+         }
+         else return c;
+      }
       else if(d == 'f') {  // /rf - set RINEX file format
          if(((e == '=') || (e == ':')) && arg[4]) {  // RINEX v2.11
             rinex_fmt = atof(&arg[4]);
@@ -21426,12 +21606,12 @@ long seek_addr;
             }
             else seek_addr = 0;
 
-            sim_file = topen(sim_name, "rb");
+            sim_file = ztopen(sim_name, "rb");
             if(sim_file == 0) return 1;
             sim_file_read |= 0x01;
 
-            fseek(sim_file, seek_addr, SEEK_SET);
             sim_eof = 0;
+            open_sim_capture(seek_addr);  // seek_addr is seconds into a .hrc capture
          }
          else return 1;
       }
@@ -21887,6 +22067,14 @@ if((sat_cols > 1) && (max_sat_display < 16)) max_sat_display = 16;
       dot_trails = toggle_option(dot_trails, e);
       if(keyboard_cmd) need_redraw = 3489;
    }
+   else if((c == 's') && (d == 'k')) {   // /sk - toggle predicted sat trails,  /sk=file - write predicted sat counts
+      if(((e == '=') || (e == ':')) && arg[4]) {
+         strncpy(sky_file, &arg[4], MAX_PATH-4);  // leave room for .sky
+         sky_file[MAX_PATH-4] = 0;
+      }
+      else sky_trails = toggle_option(sky_trails, e);
+      if(keyboard_cmd) need_redraw = 3489;
+   }
    else if((c == 's') && (d == 'o')) {   // /so - set satellite outline shape
       if(((e == '=') || (e == ':')) && (arg[4])) {
          fancy_sats = atoi(&arg[4]);
@@ -22548,6 +22736,21 @@ if((sat_cols > 1) && (max_sat_display < 16)) max_sat_display = 16;
          }
 //       user_set_log |= 0x08;
       }
+      else if(d == 'm') { // /wm - shared memory live state
+         shm_wanted = 1;
+         if(((e == '=') || (e == ':')) && arg[4]) { 
+            strncpy(shm_name, &arg[4], MAX_PATH);
+            shm_name[MAX_PATH] = 0;
+         }
+      }
+      else if(d == 's') { // /ws - metrics web server
+         metrics_server = 1;
+         metrics_addr[0] = 0;
+         if(((e == '=') || (e == ':')) && arg[4]) { 
+            strncpy(metrics_addr, &arg[4], MAX_PATH);
+            metrics_addr[MAX_PATH] = 0;
+         }
+      }
       else if(d == 'q') { // /wq - toggle log flush mode
          log_flush_mode = toggle_option(log_flush_mode, e);  // toggle log flush mode
       }